@@ -6,6 +6,9 @@
 #define __tree_structure__ __attribute__((annotate("tf_tree")))
 #define __tree_child__ __attribute__((annotate("tf_child")))
 #define __tree_traversal__ __attribute__((annotate("tf_fuse")))
+#define __short_circuit__(Field)                                               \
+  __attribute__((annotate("tf_short_circuit(" #Field ")")))
+#define __batch__ __attribute__((annotate("tf_batch")))
 #define _Bool bool
 
 enum NodeType { VAL_NODE, NULL_NODE };
@@ -14,9 +17,10 @@ class __tree_structure__ Node {
 public:
   bool Found = false;
   NodeType Type;
-  __tree_traversal__ virtual void search(int Key, bool ValidCall) {}
+  __tree_traversal__ __short_circuit__(Found) virtual void search(
+      int Key, bool ValidCall) {}
 
-  __tree_traversal__ virtual void insert(int Key, bool ValidCall) {}
+  __tree_traversal__ __batch__ virtual void insert(int Key, bool ValidCall) {}
 };
 
 class __tree_structure__ NullNode : public Node {
@@ -106,6 +110,9 @@ public:
     Node *Root = createTree(); 
     Root->insert(10, true);
     Root->insert(20, true);
+    int Keys[] = {3, 8, 1, 7, 12, 15};
+    for (int i = 0; i < 6; i++)
+      Root->insert(Keys[i], true);
     Root->search(10, true);
     if(Root->Found)
       printf("10 is found\n"); 
@@ -17,6 +17,7 @@
 #define __tree_traversal__ __attribute__((annotate("tf_fuse")))
 #define __abstract_access__(AccessList)                                        \
   __attribute__((annotate("tf_strict_access" #AccessList)))
+#define __heavy__ __attribute__((annotate("tf_heavy")))
 //#define NULL nullptr
 typedef struct Vec {
   double pt[DIMENSION];
@@ -80,12 +81,12 @@ public:
 
   __abstract_access__("(3,'r','local')") void readInteractionList();
 
-  __abstract_access__(
+  __heavy__ __abstract_access__(
       "(2,'w','local')") void updatePotentialUsingInteractionList();
 
   __abstract_access__("(2,'r','local')") double readPotential();
 
-  __abstract_access__("(2,'w','local')") void incrPotential_step3(
+  __heavy__ __abstract_access__("(2,'w','local')") void incrPotential_step3(
       double parentPotential);
 
 #if METRICS
@@ -0,0 +1,68 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define __tree_structure__ __attribute__((annotate("tf_tree")))
+#define __tree_child__ __attribute__((annotate("tf_child")))
+#define __tree_traversal__ __attribute__((annotate("tf_fuse")))
+
+// A list is a tree whose depth is its length. The traversals are global
+// functions without local declarations, so with -iterative-serial the fused
+// serial traversal runs as a loop over an explicit stack, while the unfused
+// code uses one native frame per node and per traversal.
+class __tree_structure__ Node {
+public:
+  __tree_child__ Node *Next = nullptr;
+  float Value = 1;
+  float Sum = 0;
+};
+
+__tree_traversal__ void scale(Node *N, float C) {
+  if (N == nullptr)
+    return;
+  N->Value = N->Value * C;
+  scale(N->Next, C);
+}
+
+__tree_traversal__ void offset(Node *N, float C) {
+  if (N == nullptr)
+    return;
+  N->Value = N->Value + C;
+  offset(N->Next, C);
+}
+
+// the statements after the call resume the frame of the node
+__tree_traversal__ void suffixSum(Node *N) {
+  if (N == nullptr)
+    return;
+  suffixSum(N->Next);
+  N->Sum = N->Value;
+  if (N->Next != nullptr)
+    N->Sum = N->Sum + N->Next->Sum;
+}
+
+Node *createList(int Length) {
+  Node *Head = nullptr;
+  for (int i = 0; i < Length; i++) {
+    Node *New = new Node();
+    New->Next = Head;
+    Head = New;
+  }
+  return Head;
+}
+
+int main(int argc, char **argv) {
+  Node *Head = createList(argc > 1 ? atoi(argv[1]) : 100000);
+
+  auto Start = std::chrono::high_resolution_clock::now();
+  scale(Head, 2);
+  offset(Head, 1);
+  suffixSum(Head);
+  auto End = std::chrono::high_resolution_clock::now();
+
+  printf("Runtime: %llu microseconds\n",
+         (unsigned long long)std::chrono::duration_cast<
+             std::chrono::microseconds>(End - Start)
+             .count());
+  printf("Sum: %f\n", Head != nullptr ? Head->Sum : 0.0f);
+}
@@ -101,6 +101,9 @@ int main(int argc, char **argv) {
     Doc = BuildDoc2(N);
   else if (prog == 3)
     Doc = BuildDoc3(N , N/5);
+#ifdef RELAYOUT
+  Doc = _orchard_relayout(Doc);
+#endif
 #ifndef BUILD_ONLY
   render(Doc);
 #endif
@@ -222,6 +222,9 @@ printf("Runtime: %llu microseconds\n",
 int main(int argc, char **argv) {
   int N = atoi(argv[1]);
   Node *n = BuildDoc(N);
+#ifdef RELAYOUT
+  n = _orchard_relayout(n);
+#endif
 
 #ifndef BUILD_ONLY
   render(n);
@@ -0,0 +1,210 @@
+#!/bin/bash
+
+# Write a synthetic program whose traversals orchard fuses, to measure how the
+# cost of orchard grows with the size of the traversal pipeline.
+#
+# usage: ./generate_workload.sh [options] <output file>
+#   -n <traversals>  number of traversals called in sequence (default 8)
+#   -m <statements>  statements per traversal (default 4)
+#   -k <children>    child fields per node (default 2)
+#   -d <depth>       depth of the virtual class hierarchy, 0 for traversals
+#                    written as functions on a single class (default 0)
+#
+# Every traversal i updates its own fields from the fields of traversal i - 1,
+# half of its statements before visiting the children and half after, from
+# the fields of the children, so that consecutive traversals depend on each
+# other both on the node and across the tree.
+
+TRAVERSALS=8
+STATEMENTS=4
+CHILDREN=2
+DEPTH=0
+
+while getopts "n:m:k:d:" opt; do
+  case $opt in
+  n) TRAVERSALS=$OPTARG ;;
+  m) STATEMENTS=$OPTARG ;;
+  k) CHILDREN=$OPTARG ;;
+  d) DEPTH=$OPTARG ;;
+  *) sed -n '3,17p' "$0"; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+  sed -n '3,17p' "$0"
+  exit 1
+fi
+
+PRE=$(((STATEMENTS + 1) / 2))
+
+# statements <traversal> <first> <last> <node prefix>, the statements of
+# traversal t that run before (reading the previous traversal) or after
+# (reading the children) the visits
+statements() {
+  local t=$1 first=$2 last=$3 n=$4 s c value
+  for ((s = first; s < last; s++)); do
+    if [ $s -lt $PRE ]; then
+      if [ $t -eq 0 ]; then
+        echo "  ${n}V${t}_${s} = ${n}V${t}_${s} + $((s + 1));"
+      else
+        echo "  ${n}V${t}_${s} = ${n}V$((t - 1))_${s} + $((s + 1));"
+      fi
+    else
+      c=$((s % CHILDREN))
+      if [ $t -eq 0 ]; then
+        value="${n}C${c}->V${t}_${s} + 1"
+      else
+        value="${n}C${c}->V${t}_${s} + ${n}V$((t - 1))_${s}"
+      fi
+      # the children of the single class can be null
+      if [ $DEPTH -eq 0 ]; then
+        echo "  if (${n}C${c} != nullptr)"
+        echo "    ${n}V${t}_${s} = ${value};"
+      else
+        echo "  V${t}_${s} = ${value};"
+      fi
+    fi
+  done
+}
+
+# visits <traversal>, the calls of the traversal on the children
+visits() {
+  local t=$1 c
+  for ((c = 0; c < CHILDREN; c++)); do
+    if [ $DEPTH -eq 0 ]; then
+      echo "  t${t}(n->C${c});"
+    else
+      echo "  C${c}->t${t}();"
+    fi
+  done
+}
+
+# fields children|values
+fields() {
+  local t s c
+  if [ "$1" == "children" ]; then
+    for ((c = 0; c < CHILDREN; c++)); do
+      echo "  __tree_child__ Node *C${c} = nullptr;"
+    done
+  else
+    for ((t = 0; t < TRAVERSALS; t++)); do
+      for ((s = 0; s < STATEMENTS; s++)); do
+        echo "  int V${t}_${s} = 0;"
+      done
+    done
+  fi
+}
+
+{
+  echo "// generated by generate_workload.sh -n $TRAVERSALS -m $STATEMENTS -k $CHILDREN -d $DEPTH"
+  cat <<'EOF'
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define __tree_structure__ __attribute__((annotate("tf_tree")))
+#define __tree_child__ __attribute__((annotate("tf_child")))
+#define __tree_traversal__ __attribute__((annotate("tf_fuse")))
+
+EOF
+
+  if [ $DEPTH -eq 0 ]; then
+    echo "class __tree_structure__ Node {"
+    echo "public:"
+    fields children
+    fields values
+    echo "};"
+    echo
+    for ((t = 0; t < TRAVERSALS; t++)); do
+      echo "__tree_traversal__ void t${t}(Node *n) {"
+      echo "  if (n == nullptr)"
+      echo "    return;"
+      statements $t 0 $PRE "n->"
+      visits $t
+      statements $t $PRE $STATEMENTS "n->"
+      echo "}"
+      echo
+    done
+    INNER=Node
+    LEAF=Node
+  else
+    # the leaves are instances of the base class, whose traversals do nothing
+    echo "class __tree_structure__ Node {"
+    echo "public:"
+    fields values
+    for ((t = 0; t < TRAVERSALS; t++)); do
+      echo "  __tree_traversal__ virtual void t${t}() {}"
+    done
+    echo "};"
+    echo
+
+    # intermediate classes, that only update their own fields
+    BASE=Node
+    for ((l = 1; l < DEPTH; l++)); do
+      echo "class __tree_structure__ Level${l} : public ${BASE} {"
+      echo "public:"
+      for ((t = 0; t < TRAVERSALS; t++)); do
+        echo "  __tree_traversal__ void t${t}() override {"
+        statements $t 0 $PRE "" | sed 's/^/  /'
+        echo "  }"
+      done
+      echo "};"
+      echo
+      BASE=Level${l}
+    done
+
+    echo "class __tree_structure__ Inner : public ${BASE} {"
+    echo "public:"
+    fields children
+    for ((t = 0; t < TRAVERSALS; t++)); do
+      echo "  __tree_traversal__ void t${t}() override {"
+      {
+        statements $t 0 $PRE ""
+        visits $t
+        statements $t $PRE $STATEMENTS ""
+      } | sed 's/^/  /'
+      echo "  }"
+    done
+    echo "};"
+    echo
+    INNER=Inner
+    LEAF=Node
+  fi
+
+  cat <<EOF
+Node *createTree(int Height) {
+  if (Height == 0)
+    return $([ $DEPTH -eq 0 ] && echo nullptr || echo "new $LEAF()");
+  ${INNER} *Root = new ${INNER}();
+EOF
+  for ((c = 0; c < CHILDREN; c++)); do
+    echo "  Root->C${c} = createTree(Height - 1);"
+  done
+  cat <<EOF
+  return Root;
+}
+
+int main(int argc, char **argv) {
+  Node *Root = createTree(argc > 1 ? atoi(argv[1]) : 10);
+
+  auto Start = std::chrono::high_resolution_clock::now();
+EOF
+  for ((t = 0; t < TRAVERSALS; t++)); do
+    if [ $DEPTH -eq 0 ]; then
+      echo "  t${t}(Root);"
+    else
+      echo "  Root->t${t}();"
+    fi
+  done
+  cat <<EOF
+  auto End = std::chrono::high_resolution_clock::now();
+
+  printf("Runtime: %llu microseconds\\n",
+         (unsigned long long)std::chrono::duration_cast<
+             std::chrono::microseconds>(End - Start)
+             .count());
+  printf("Checksum: %d\\n", Root->V$((TRAVERSALS - 1))_$((STATEMENTS - 1)));
+}
+EOF
+} >"$1"
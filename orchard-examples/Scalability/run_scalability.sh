@@ -0,0 +1,118 @@
+#!/bin/bash
+
+# Measure the time and the memory of each phase of orchard on synthetic
+# programs of growing size, written by generate_workload.sh.
+#
+# usage: ./run_scalability.sh [options]
+#   -n "<counts>"  numbers of traversals (default "2 4 8 16 32")
+#   -m "<counts>"  statements per traversal (default "4")
+#   -k "<counts>"  child fields per node (default "2")
+#   -d "<depths>"  depths of the virtual class hierarchy (default "0")
+#   -r <reps>      runs per configuration (default 3)
+#   -o <dir>       output directory (default scalability)
+#   -b <csv>       the phases.csv of an earlier revision to compare with
+#   -t <ratio>     slowdown over the earlier revision reported as a
+#                  regression (default 1.25)
+#
+# Every combination of the given values is measured. The phases of each run,
+# as written by orchard -phase-times, are appended to <dir>/phases.csv with the
+# revision and the configuration. With -b, the fastest run of each phase and
+# configuration is compared with the earlier one, and the script fails if a
+# phase that took more than 10 milliseconds slowed down by more than the ratio.
+# Set ORCHARD to the orchard binary and ORCHARD_FLAGS to the compiler flags.
+
+ORCHARD=${ORCHARD:-orchard}
+ORCHARD_FLAGS=${ORCHARD_FLAGS:-"-std=c++11"}
+
+TRAVERSALS="2 4 8 16 32"
+STATEMENTS="4"
+CHILDREN="2"
+DEPTHS="0"
+REPS=3
+OUT=scalability
+BASELINE=""
+THRESHOLD=1.25
+
+while getopts "n:m:k:d:r:o:b:t:" opt; do
+  case $opt in
+  n) TRAVERSALS=$OPTARG ;;
+  m) STATEMENTS=$OPTARG ;;
+  k) CHILDREN=$OPTARG ;;
+  d) DEPTHS=$OPTARG ;;
+  r) REPS=$OPTARG ;;
+  o) OUT=$OPTARG ;;
+  b) BASELINE=$OPTARG ;;
+  t) THRESHOLD=$OPTARG ;;
+  *) sed -n '3,23p' "$0"; exit 1 ;;
+  esac
+done
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+REVISION=$(git -C "$ROOT" rev-parse --short HEAD 2>/dev/null || echo unknown)
+
+mkdir -p "$OUT/work"
+PHASES="$OUT/phases.csv"
+echo "revision,traversals,statements,children,depth,repetition,phase,calls,seconds,peak_rss_growth_kb" >"$PHASES"
+
+for n in $TRAVERSALS; do
+  for m in $STATEMENTS; do
+    for k in $CHILDREN; do
+      for d in $DEPTHS; do
+        config="$n,$m,$k,$d"
+        echo "traversals $n statements $m children $k depth $d" >&2
+        for ((i = 1; i <= REPS; i++)); do
+          # orchard rewrites its input, so each run starts from a new copy
+          work="$OUT/work/$n-$m-$k-$d"
+          mkdir -p "$work"
+          "$ROOT/generate_workload.sh" -n $n -m $m -k $k -d $d "$work/main.cpp"
+          if ! "$ORCHARD" -phase-times="$work/times.csv" "$work/main.cpp" -- \
+            $ORCHARD_FLAGS >"$work/orchard.log" 2>&1 ||
+            [ ! -f "$work/times.csv" ]; then
+            echo "orchard failed on $config, see $work/orchard.log" >&2
+            continue
+          fi
+          tail -n +2 "$work/times.csv" |
+            sed "s/^/$REVISION,$config,$i,/" >>"$PHASES"
+          rm "$work/times.csv"
+        done
+      done
+    done
+  done
+done
+
+echo "results written to $PHASES" >&2
+[ -z "$BASELINE" ] && exit 0
+
+# the fastest run of each phase and configuration of both revisions
+set -o pipefail
+awk -F, -v Threshold=$THRESHOLD '
+FNR == 1 { File++; next }
+{
+  Key = $2 "," $3 "," $4 "," $5 "," $7
+  if (File == 1) {
+    if (!(Key in Before) || $9 < Before[Key])
+      Before[Key] = $9
+  } else {
+    if (!(Key in After)) {
+      After[Key] = $9
+      Keys[++Count] = Key
+    } else if ($9 < After[Key])
+      After[Key] = $9
+  }
+}
+END {
+  print "traversals,statements,children,depth,phase,before_seconds,after_seconds,ratio"
+  for (i = 1; i <= Count; i++) {
+    K = Keys[i]
+    if (!(K in Before))
+      continue
+    Ratio = Before[K] > 0 ? After[K] / Before[K] : 1
+    Flag = ""
+    if (Ratio > Threshold && After[K] > 0.01) {
+      Flag = ",REGRESSION"
+      Regressions++
+    }
+    printf "%s,%g,%g,%.3f%s\n", K, Before[K], After[K], Ratio, Flag
+  }
+  exit(Regressions > 0)
+}' "$BASELINE" "$PHASES" | tee "$OUT/comparison.csv"
@@ -0,0 +1,68 @@
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define __tree_structure__ __attribute__((annotate("tf_tree")))
+#define __tree_child__ __attribute__((annotate("tf_child")))
+#define __tree_traversal__ __attribute__((annotate("tf_fuse")))
+
+// The traversals have statements before and after their child calls and
+// return early from the middle of their body, so with -unroll-depth the
+// inlined serial bodies hold several blocks, each with its exit label, and
+// gotos to those labels for the early returns.
+class __tree_structure__ Node {
+public:
+  __tree_child__ Node *Left = nullptr;
+  __tree_child__ Node *Right = nullptr;
+  int Value = 1;
+  int Depth = 0;
+  int Size = 0;
+};
+
+__tree_traversal__ void setDepth(Node *N, int Depth) {
+  if (N == nullptr)
+    return;
+  N->Depth = Depth;
+  if (N->Value < 0)
+    return;
+  setDepth(N->Left, Depth + 1);
+  setDepth(N->Right, Depth + 1);
+  N->Value = N->Value + N->Depth;
+}
+
+__tree_traversal__ void computeSize(Node *N) {
+  if (N == nullptr)
+    return;
+  N->Size = 1;
+  computeSize(N->Left);
+  computeSize(N->Right);
+  if (N->Left == nullptr)
+    return;
+  N->Size = N->Size + N->Left->Size;
+  if (N->Right != nullptr)
+    N->Size = N->Size + N->Right->Size;
+}
+
+Node *createTree(int Height) {
+  if (Height == 0)
+    return nullptr;
+  Node *New = new Node();
+  New->Left = createTree(Height - 1);
+  New->Right = createTree(Height - 1);
+  return New;
+}
+
+int main(int argc, char **argv) {
+  Node *Root = createTree(argc > 1 ? atoi(argv[1]) : 20);
+
+  auto Start = std::chrono::high_resolution_clock::now();
+  setDepth(Root, 0);
+  computeSize(Root);
+  auto End = std::chrono::high_resolution_clock::now();
+
+  printf("Runtime: %llu microseconds\n",
+         (unsigned long long)std::chrono::duration_cast<
+             std::chrono::microseconds>(End - Start)
+             .count());
+  printf("Size: %d\n", Root != nullptr ? Root->Size : 0);
+}
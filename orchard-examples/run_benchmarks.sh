@@ -0,0 +1,211 @@
+#!/bin/bash
+
+# Build the unfused, fused serial and fused parallel variants of the examples
+# and time them over a sweep of input sizes, tree shapes and worker counts.
+#
+# usage: ./run_benchmarks.sh [options] [example...]
+#   -s "<sizes>"    input sizes, overrides the default sizes of each example
+#   -w "<workers>"  worker counts of the fused parallel variant (default "1 2 4 8")
+#   -r <reps>       timed repetitions per configuration (default 5)
+#   -u <warmup>     untimed warmup runs per configuration (default 1)
+#   -o <dir>        output directory (default results)
+#   -g              regenerate the fused code with generate_fused_code.sh
+#   -p              read the PAPI counters (builds with -DPAPI -lpapi)
+#
+# The examples default to all of them. Every run is written to <dir>/raw.csv,
+# the medians and the speedups over the unfused variant to <dir>/summary.csv
+# and <dir>/summary.json. The fused serial variant is the fused parallel code
+# run by a single worker.
+
+CXX=${CXX:-clang++}
+CXXFLAGS=${CXXFLAGS:-"-O3 -std=c++11 -w"}
+CILKFLAGS=${CILKFLAGS-"-fopencilk"}
+
+SIZES=""
+WORKERS="1 2 4 8"
+REPS=5
+WARMUP=1
+OUT=results
+REGENERATE=0
+PAPI=0
+
+while getopts "s:w:r:u:o:gp" opt; do
+  case $opt in
+  s) SIZES=$OPTARG ;;
+  w) WORKERS=$OPTARG ;;
+  r) REPS=$OPTARG ;;
+  u) WARMUP=$OPTARG ;;
+  o) OUT=$OPTARG ;;
+  g) REGENERATE=1 ;;
+  p) PAPI=1 ;;
+  *) sed -n '3,19p' "$0"; exit 1 ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+ROOT=$(cd "$(dirname "$0")" && pwd)
+
+# name | directory | arguments, {N} is the size and {S} the shape | shapes |
+# default sizes
+EXAMPLES=(
+  "AST|AST|{N} 100 {S}|1 2 3 4|1000 10000"
+  "RenderTree-Grafter|RenderTree/Grafter|{N} {S}|1 2 3|1000 10000"
+  "RenderTree-Treefuser|RenderTree/Treefuser|{N}|-|1000 10000"
+  "FMM|FastMultipoleMethod/Grafter|{N}|-|10000 100000"
+  "PiecewiseFunctions|PiecewiseFunctions|{N} {S}|1 2 3|10 15"
+  "BinaryTree|BinaryTree|-|-|-"
+  "LinkedList|LinkedList|{N}|-|10000 100000"
+  "UnrolledTree|UnrolledTree|{N}|-|16 20"
+)
+
+SELECTED=("$@")
+is_selected() {
+  [ ${#SELECTED[@]} -eq 0 ] && return 0
+  for name in "${SELECTED[@]}"; do
+    [ "$name" == "$1" ] && return 0
+  done
+  return 1
+}
+
+# build <source directory> <binary>
+build() {
+  local flags="$CXXFLAGS $CILKFLAGS"
+  local libs=""
+  if [ $PAPI -eq 1 ]; then
+    flags="$flags -DPAPI"
+    libs="-lpapi"
+  fi
+  $CXX $flags "$1/main.cpp" -o "$2" $libs -lpthread
+}
+
+# run <binary> <workers> <arguments...>, prints the runtime in microseconds
+# followed by the PAPI counters, separated by commas
+run() {
+  local binary=$1 workers=$2
+  shift 2
+  local start end output runtime
+  start=$(date +%s%N)
+  output=$(CILK_NWORKERS=$workers "$binary" "$@" 2>&1)
+  end=$(date +%s%N)
+  runtime=$(echo "$output" | sed -n 's/^Runtime: *\([0-9]*\).*/\1/p' | tail -n 1)
+  # examples that do not time themselves are timed as a whole
+  [ -z "$runtime" ] && runtime=$(((end - start) / 1000))
+  local counters=""
+  if [ $PAPI -eq 1 ]; then
+    counters=$(echo "$output" | awk -F' : ' '
+      /Cache Misses|Instructions/ { printf ",%s", $2 }')
+  fi
+  echo "$runtime$counters"
+}
+
+mkdir -p "$OUT/bin"
+RAW="$OUT/raw.csv"
+HEADER="example,shape,size,variant,workers,repetition,runtime_us"
+[ $PAPI -eq 1 ] && HEADER="$HEADER,l2_misses,l3_misses,instructions"
+echo "$HEADER" >"$RAW"
+
+for entry in "${EXAMPLES[@]}"; do
+  IFS='|' read -r name dir arguments shapes sizes <<<"$entry"
+  is_selected "$name" || continue
+  [ -n "$SIZES" ] && [ "$sizes" != "-" ] && sizes=$SIZES
+
+  if [ $REGENERATE -eq 1 ] || [ ! -d "$ROOT/$dir/FUSED" ]; then
+    if [ -x "$ROOT/$dir/generate_fused_code.sh" ]; then
+      (cd "$ROOT/$dir" && ./generate_fused_code.sh) >/dev/null 2>&1
+    fi
+  fi
+
+  variants=()
+  if build "$ROOT/$dir/UNFUSED" "$OUT/bin/$name-unfused"; then
+    variants+=("unfused")
+  else
+    echo "$name: the unfused code does not build, skipping it" >&2
+  fi
+  if [ -d "$ROOT/$dir/FUSED" ] &&
+    build "$ROOT/$dir/FUSED" "$OUT/bin/$name-fused"; then
+    variants+=("fused-serial" "fused-parallel")
+  else
+    echo "$name: no fused code, only the unfused variant runs" >&2
+  fi
+
+  for shape in $shapes; do
+    for size in $sizes; do
+      args=${arguments//\{N\}/$size}
+      args=${args//\{S\}/$shape}
+      [ "$args" == "-" ] && args=""
+      for variant in "${variants[@]}"; do
+        case $variant in
+        unfused) binary="$OUT/bin/$name-unfused"; counts=1 ;;
+        fused-serial) binary="$OUT/bin/$name-fused"; counts=1 ;;
+        fused-parallel) binary="$OUT/bin/$name-fused"; counts=$WORKERS ;;
+        esac
+        for workers in $counts; do
+          echo "$name shape $shape size $size $variant on $workers worker(s)" >&2
+          for ((i = 0; i < WARMUP; i++)); do
+            run "$binary" "$workers" $args >/dev/null
+          done
+          for ((i = 1; i <= REPS; i++)); do
+            echo "$name,$shape,$size,$variant,$workers,$i,$(run "$binary" "$workers" $args)" >>"$RAW"
+          done
+        done
+      done
+    done
+  done
+done
+
+# medians per configuration and speedups over the unfused variant
+sort -t, -k1,1 -k2,2 -k3,3 -k4,4 -k5,5n -k7,7n <(tail -n +2 "$RAW") | awk -F, -v Out="$OUT" -v Papi=$PAPI '
+function flush() {
+  if (Count == 0)
+    return
+  Median = Count % 2 ? Runs[(Count + 1) / 2] : (Runs[Count / 2] + Runs[Count / 2 + 1]) / 2
+  Keys[++Configs] = Key
+  Medians[Key] = Median
+  if (Variant == "unfused")
+    Baseline[Case] = Median
+  CaseOf[Key] = Case
+  Count = 0
+}
+{
+  NewKey = $1 "," $2 "," $3 "," $4 "," $5
+  if (NewKey != Key)
+    flush()
+  Key = NewKey
+  Case = $1 "," $2 "," $3
+  Variant = $4
+  Runs[++Count] = $7
+}
+END {
+  flush()
+  Summary = Out "/summary.csv"
+  Json = Out "/summary.json"
+  print "example,shape,size,variant,workers,median_runtime_us,speedup" > Summary
+  print "[" > Json
+  for (i = 1; i <= Configs; i++) {
+    K = Keys[i]
+    Speedup = Baseline[CaseOf[K]] && Medians[K] ? Baseline[CaseOf[K]] / Medians[K] : 0
+    print K "," Medians[K] "," sprintf("%.3f", Speedup) > Summary
+    split(K, F, ",")
+    printf "  {\"example\": \"%s\", \"shape\": \"%s\", \"size\": \"%s\", \"variant\": \"%s\", \"workers\": %s, \"median_runtime_us\": %s, \"speedup\": %.3f}%s\n", F[1], F[2], F[3], F[4], F[5], Medians[K], Speedup, i < Configs ? "," : "" > Json
+  }
+  print "]" > Json
+}'
+
+# the hardware counters are summarized by their medians too
+if [ $PAPI -eq 1 ]; then
+  for column in 8 9 10; do
+    sort -t, -k1,1 -k2,2 -k3,3 -k4,4 -k5,5n -k${column},${column}n <(tail -n +2 "$RAW") | awk -F, -v Column=$column '
+    function flush() {
+      if (Count)
+        print Key "," (Count % 2 ? Values[(Count + 1) / 2] : (Values[Count / 2] + Values[Count / 2 + 1]) / 2)
+      Count = 0
+    }
+    { NewKey = $1 "," $2 "," $3 "," $4 "," $5; if (NewKey != Key) flush(); Key = NewKey; Values[++Count] = $Column }
+    END { flush() }' >"$OUT/counter$((column - 7)).csv"
+  done
+  paste -d, "$OUT/counter1.csv" <(cut -d, -f6 "$OUT/counter2.csv") <(cut -d, -f6 "$OUT/counter3.csv") |
+    sed '1i example,shape,size,variant,workers,median_l2_misses,median_l3_misses,median_instructions' >"$OUT/counters.csv"
+  rm -f "$OUT"/counter[123].csv
+fi
+
+echo "results written to $OUT" >&2
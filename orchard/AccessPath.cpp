@@ -11,6 +11,7 @@
 
 #include "AccessPath.h"
 #include "FunctionAnalyzer.h"
+#include "PhaseTimer.h"
 
 using namespace clang;
 
@@ -391,6 +392,7 @@ bool AccessPath::handleNextExpression(clang::Stmt *NextExpression) {
 
 const FSM &AccessPath::getWriteAutomata() {
   if (WriteAutomata == nullptr) {
+    PhaseTimer::Scope Timer("fsm-access-automata");
     WriteAutomata = new FSM();
     int StateId = WriteAutomata->AddState();
     WriteAutomata->SetStart(StateId /*0*/);
@@ -459,6 +461,7 @@ const FSM &AccessPath::getWriteAutomata() {
 
 const FSM &AccessPath::getReadAutomata() {
   if (ReadAutomata == nullptr) {
+    PhaseTimer::Scope Timer("fsm-access-automata");
     ReadAutomata = new FSM();
     int StateId = ReadAutomata->AddState();
     ReadAutomata->SetStart(StateId /*0*/);
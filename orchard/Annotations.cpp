@@ -13,44 +13,66 @@
 #include "Logger.h"
 #include <stdio.h>
 
+// Return the first annotation of the declaration that starts with Prefix, a
+// declaration can carry several annotations (e.g. tf_heavy and
+// tf_strict_access)
+static const clang::AnnotateAttr *findAnnotation(const clang::Decl *Declaration,
+                                                 StringRef Prefix) {
+  for (auto *Attr : Declaration->specific_attrs<clang::AnnotateAttr>())
+    if (Attr->getAnnotation().startswith(Prefix))
+      return Attr;
+  return nullptr;
+}
+
+static bool hasAnnotation(const clang::Decl *Declaration, StringRef Name) {
+  for (auto *Attr : Declaration->specific_attrs<clang::AnnotateAttr>())
+    if (Attr->getAnnotation() == Name)
+      return true;
+  return false;
+}
+
 bool hasFuseAnnotation(clang::FunctionDecl *Declaration) {
-  return Declaration->hasAttr<clang::AnnotateAttr>() &&
-         (Declaration->getAttr<clang::AnnotateAttr>()
-              ->getAnnotation()
-              .str()
-              .compare("tf_fuse") == 0);
+  return hasAnnotation(Declaration, "tf_fuse");
 }
 
 bool hasTreeAnnotation(const clang::CXXRecordDecl *Declaration) {
-
-  return Declaration->hasAttr<clang::AnnotateAttr>() &&
-         Declaration->getAttr<clang::AnnotateAttr>()
-                 ->getAnnotation()
-                 .str()
-                 .compare("tf_tree") == 0;
+  return hasAnnotation(Declaration, "tf_tree");
 }
 
 bool hasChildAnnotation(clang::FieldDecl *Declaration) {
-
-  return Declaration->hasAttr<clang::AnnotateAttr>() &&
-         Declaration->getAttr<clang::AnnotateAttr>()
-                 ->getAnnotation()
-                 .str()
-                 .compare("tf_child") == 0;
+  return hasAnnotation(Declaration, "tf_child");
 }
 
 bool hasStrictAccessAnnotation(clang::Decl *Declaration) {
+  return findAnnotation(Declaration, "tf_strict_access") != nullptr;
+}
+
+bool hasHeavyAnnotation(clang::Decl *Declaration) {
+  return hasAnnotation(Declaration, "tf_heavy");
+}
+
+bool hasBatchAnnotation(const clang::FunctionDecl *Declaration) {
+  for (auto *Redeclaration : Declaration->redecls())
+    if (hasAnnotation(Redeclaration, "tf_batch"))
+      return true;
+  // an override is batchable if the method that it overrides is
+  if (auto *Method = dyn_cast<clang::CXXMethodDecl>(Declaration))
+    for (auto *Overridden : Method->overridden_methods())
+      if (hasBatchAnnotation(Overridden))
+        return true;
+  return false;
+}
 
-  return Declaration->hasAttr<clang::AnnotateAttr>() &&
-         Declaration->getAttr<clang::AnnotateAttr>()
-             ->getAnnotation()
-             .startswith("tf_strict_access");
-  ;
+StringRef getShortCircuitField(const clang::Decl *Declaration) {
+  auto *Attr = findAnnotation(Declaration, "tf_short_circuit");
+  if (!Attr)
+    return "";
+  return Attr->getAnnotation().split('(').second.split(')').first.trim();
 }
 
 vector<StrictAccessInfo> getStrictAccessInfo(clang::Decl *Declaration) {
   StringRef Annotation =
-      Declaration->getAttr<clang::AnnotateAttr>()->getAnnotation();
+      findAnnotation(Declaration, "tf_strict_access")->getAnnotation();
 
   std::vector<StrictAccessInfo> StrictAccessInfoVector;
 
@@ -0,0 +1,614 @@
+//===--- BatchSynthesizer.cpp ---------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "BatchSynthesizer.h"
+#include "DependenceAnalyzer.h"
+#include "DependenceGraph.h"
+#include "FunctionsFinder.h"
+#include "Logger.h"
+#include "RuntimeSupport.h"
+#include "TraversalSynthesizer.h"
+#include <algorithm>
+
+using namespace std;
+
+std::set<const clang::CallExpr *> BatchSynthesizer::BatchedCalls =
+    std::set<const clang::CallExpr *>();
+
+std::set<const clang::FunctionDecl *> BatchSynthesizer::Synthesized =
+    std::set<const clang::FunctionDecl *>();
+
+std::set<std::pair<const clang::CXXRecordDecl *, std::string>>
+    BatchSynthesizer::InsertedStubs =
+        std::set<std::pair<const clang::CXXRecordDecl *, std::string>>();
+
+// Return the node visited by a traversal call, the object of member calls and
+// the first argument of global ones
+static clang::Expr *getVisitedNode(clang::CallExpr *Call) {
+  if (auto *MemberCall = dyn_cast<clang::CXXMemberCallExpr>(Call))
+    return MemberCall->getImplicitObjectArgument();
+  return Call->getArg(0);
+}
+
+static const clang::CXXRecordDecl *getVisitedType(clang::CallExpr *Call) {
+  auto Type = getVisitedNode(Call)->getType();
+  if (Type->isPointerType())
+    return Type->getPointeeCXXRecordDecl();
+  return Type->getAsCXXRecordDecl();
+}
+
+static std::string getSourceText(const clang::Expr *Expr,
+                                 const clang::ASTContext *Ctx) {
+  return Lexer::getSourceText(
+             CharSourceRange::getTokenRange(Expr->getSourceRange()),
+             Ctx->getSourceManager(), Ctx->getLangOpts())
+      .str();
+}
+
+// Collect the variables assigned, incremented or decremented within Stmt
+static void collectWrittenVariables(const clang::Stmt *Stmt,
+                                    std::set<const clang::ValueDecl *> &Vars) {
+  const clang::Expr *Written = nullptr;
+  if (auto *BinaryOperator = dyn_cast<clang::BinaryOperator>(Stmt)) {
+    if (BinaryOperator->isAssignmentOp())
+      Written = BinaryOperator->getLHS();
+  } else if (auto *UnaryOperator = dyn_cast<clang::UnaryOperator>(Stmt)) {
+    if (UnaryOperator->isIncrementDecrementOp())
+      Written = UnaryOperator->getSubExpr();
+  }
+  if (Written)
+    if (auto *DeclRef =
+            dyn_cast<clang::DeclRefExpr>(Written->IgnoreParenImpCasts()))
+      Vars.insert(DeclRef->getDecl());
+
+  for (auto *Child : Stmt->children())
+    if (Child)
+      collectWrittenVariables(Child, Vars);
+}
+
+// Return true if Expr has the same value in every iteration of Loop: it calls
+// nothing and only reads variables declared before the loop that the loop
+// does not write
+static bool isLoopInvariant(const clang::Stmt *Expr, const clang::Stmt *Loop,
+                            const std::set<const clang::ValueDecl *> &Written,
+                            const clang::SourceManager &SM) {
+  if (isa<clang::CallExpr>(Expr) || isa<clang::CXXConstructExpr>(Expr))
+    return false;
+  if (auto *DeclRef = dyn_cast<clang::DeclRefExpr>(Expr))
+    if (Written.count(DeclRef->getDecl()) ||
+        isDeclaredIn(DeclRef->getDecl(), Loop, SM))
+      return false;
+  for (auto *Child : Expr->children())
+    if (Child && !isLoopInvariant(Child, Loop, Written, SM))
+      return false;
+  return true;
+}
+
+// Return true if Expr calls a function or a non trivial constructor. The
+// batched walk runs after the loop, so such code would see the tree before
+// the calls of the earlier iterations instead of after them
+static bool hasCalls(const clang::Stmt *Expr) {
+  if (isa<clang::CallExpr>(Expr))
+    return true;
+  if (auto *Construct = dyn_cast<clang::CXXConstructExpr>(Expr))
+    if (!Construct->getConstructor()->isTrivial())
+      return true;
+  for (auto *Child : Expr->children())
+    if (Child && hasCalls(Child))
+      return true;
+  return false;
+}
+
+// Return true if Loop declares Decl
+static bool isDeclaredIn(const clang::ValueDecl *Decl, const clang::Stmt *Loop,
+                         const clang::SourceManager &SM) {
+  auto Loc = Decl->getLocation();
+  return !SM.isBeforeInTranslationUnit(Loc, Loop->getBeginLoc()) &&
+         !SM.isBeforeInTranslationUnit(Loop->getEndLoc(), Loc);
+}
+
+// Return true if Expr takes the address of a variable declared in Loop, which
+// a lane would keep after the iteration that declares it ends
+static bool takesLoopAddress(const clang::Stmt *Expr, const clang::Stmt *Loop,
+                             const clang::SourceManager &SM) {
+  const clang::Expr *Operand = nullptr;
+  if (auto *UnaryOperator = dyn_cast<clang::UnaryOperator>(Expr)) {
+    if (UnaryOperator->getOpcode() == clang::UO_AddrOf)
+      Operand = UnaryOperator->getSubExpr();
+  } else if (auto *Cast = dyn_cast<clang::ImplicitCastExpr>(Expr)) {
+    if (Cast->getCastKind() == clang::CK_ArrayToPointerDecay)
+      Operand = Cast->getSubExpr();
+  }
+  if (Operand)
+    if (auto *DeclRef =
+            dyn_cast<clang::DeclRefExpr>(Operand->IgnoreParenImpCasts()))
+      if (isDeclaredIn(DeclRef->getDecl(), Loop, SM))
+        return true;
+
+  for (auto *Child : Expr->children())
+    if (Child && takesLoopAddress(Child, Loop, SM))
+      return true;
+  return false;
+}
+
+bool BatchSynthesizer::VisitFunctionDecl(clang::FunctionDecl *FuncDecl) {
+  CurrentFuncDecl = FuncDecl;
+  return true;
+}
+
+bool BatchSynthesizer::VisitForStmt(clang::ForStmt *Loop) {
+  recordLoop(Loop, Loop->getBody());
+  return true;
+}
+
+bool BatchSynthesizer::VisitCXXForRangeStmt(clang::CXXForRangeStmt *Loop) {
+  recordLoop(Loop, Loop->getBody());
+  return true;
+}
+
+bool BatchSynthesizer::recordLoop(clang::Stmt *Loop, clang::Stmt *Body) {
+  // loops within traversals are part of the traversal's own code
+  if (!CurrentFuncDecl || hasFuseAnnotation(CurrentFuncDecl) ||
+      Loop->getBeginLoc().isMacroID() ||
+      !clang::Rewriter::isRewritable(Loop->getBeginLoc()))
+    return false;
+
+  auto *Statement = Body;
+  if (auto *CompoundStmt = dyn_cast<clang::CompoundStmt>(Body)) {
+    if (CompoundStmt->size() != 1)
+      return false;
+    Statement = CompoundStmt->body_front();
+  }
+  auto *Call = dyn_cast<clang::CallExpr>(Statement);
+  if (!Call || !Call->getCalleeDecl() ||
+      !Call->getCalleeDecl()->getAsFunction())
+    return false;
+  auto *Callee = Call->getCalleeDecl()->getAsFunction();
+  if (!hasBatchAnnotation(Callee))
+    return false;
+
+  if (!canBatch(Call)) {
+    Logger::getStaticLogger().logWarn(
+        "batch: " + Callee->getQualifiedNameAsString() +
+        " or a traversal that it calls cannot run over lanes, skipping");
+    return false;
+  }
+
+  std::set<const clang::ValueDecl *> Written;
+  collectWrittenVariables(Loop, Written);
+  if (!isLoopInvariant(getVisitedNode(Call), Loop, Written,
+                       Ctx->getSourceManager())) {
+    Logger::getStaticLogger().logWarn(
+        "batch: the node visited by " + Callee->getQualifiedNameAsString() +
+        " changes within the loop, skipping");
+    return false;
+  }
+
+  // the header and the arguments run in the loop, before the batched walk
+  std::vector<const clang::Stmt *> Header;
+  if (auto *For = dyn_cast<clang::ForStmt>(Loop))
+    Header = {For->getInit(), For->getCond(), For->getInc()};
+  else
+    Header = {dyn_cast<clang::CXXForRangeStmt>(Loop)->getRangeInit()};
+  for (auto *Argument : Call->arguments())
+    Header.push_back(Argument);
+  for (auto *Part : Header) {
+    if (!Part)
+      continue;
+    if (hasCalls(Part)) {
+      Logger::getStaticLogger().logWarn(
+          "batch: the loop of " + Callee->getQualifiedNameAsString() +
+          " calls functions in its header or arguments, skipping");
+      return false;
+    }
+    if (takesLoopAddress(Part, Loop, Ctx->getSourceManager())) {
+      Logger::getStaticLogger().logWarn(
+          "batch: an argument of " + Callee->getQualifiedNameAsString() +
+          " points to a variable of the loop, skipping");
+      return false;
+    }
+  }
+
+  Loops.push_back({Loop, Body, Call, CurrentFuncDecl});
+  BatchedCalls.insert(Call);
+  return true;
+}
+
+std::vector<FunctionAnalyzer *> BatchSynthesizer::getPossibleCallees(
+    clang::FunctionDecl *Callee, const clang::CXXRecordDecl *StaticType,
+    std::vector<const clang::CXXRecordDecl *> *DynamicTypes) {
+  std::vector<FunctionAnalyzer *> Callees;
+  Callee = Callee->getDefinition();
+  if (!Callee || !FunctionsFinder::FunctionsInformation.count(Callee))
+    return Callees;
+
+  auto *Info = FunctionsFinder::getFunctionInfo(Callee);
+  if (!Info->isVirtual()) {
+    Callees.push_back(Info);
+    if (DynamicTypes)
+      DynamicTypes->push_back(nullptr);
+    return Callees;
+  }
+
+  std::vector<const clang::CXXRecordDecl *> Types = {StaticType};
+  for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[StaticType])
+    Types.push_back(DerivedType);
+  for (auto *Type : Types) {
+    auto *Override = Info->getDeclAsCXXMethod()->getCorrespondingMethodInClass(
+        Type->getDefinition());
+    // no node of an abstract class without a definition is visited
+    if ((!Override || !Override->getDefinition()) && Type->isAbstract())
+      continue;
+    if (!Override || !Override->getDefinition() ||
+        !FunctionsFinder::FunctionsInformation.count(
+            Override->getDefinition()))
+      return std::vector<FunctionAnalyzer *>();
+    Callees.push_back(
+        FunctionsFinder::getFunctionInfo(Override->getDefinition()));
+    if (DynamicTypes)
+      DynamicTypes->push_back(Type);
+  }
+  return Callees;
+}
+
+bool BatchSynthesizer::canBatch(clang::CallExpr *Call) {
+  std::set<FunctionAnalyzer *> Visited;
+  std::vector<FunctionAnalyzer *> WorkList;
+  std::vector<clang::CallExpr *> Calls = {Call};
+
+  while (!Calls.empty() || !WorkList.empty()) {
+    if (!Calls.empty()) {
+      Call = Calls.back();
+      Calls.pop_back();
+      for (auto *Argument : Call->arguments())
+        if (isa<clang::CXXDefaultArgExpr>(Argument))
+          return false;
+      if (!getVisitedType(Call))
+        return false;
+      auto Callees = getPossibleCallees(
+          Call->getCalleeDecl()->getAsFunction(), getVisitedType(Call),
+          nullptr);
+      if (Callees.empty())
+        return false;
+      WorkList.insert(WorkList.end(), Callees.begin(), Callees.end());
+      continue;
+    }
+
+    auto *Info = WorkList.back();
+    WorkList.pop_back();
+    if (Visited.count(Info))
+      continue;
+    Visited.insert(Info);
+
+    if (!Info->isValidFuse())
+      return false;
+    // a lane owns a copy of its arguments, writes to them are not seen by
+    // the caller
+    for (auto *Param : getLaneParams(Info->getFunctionDecl())) {
+      auto Type = Param->getType();
+      if (Type->isReferenceType() &&
+          !Type.getNonReferenceType().isConstQualified())
+        return false;
+    }
+
+    for (auto *Stmt : Info->getStatements()) {
+      // the locals of a lane would have to live across the statements
+      if (isa<clang::DeclStmt>(Stmt->Stmt))
+        return false;
+      if (Stmt->isCallStmt())
+        Calls.push_back(dyn_cast<clang::CallExpr>(Stmt->Stmt));
+    }
+  }
+  return true;
+}
+
+std::vector<clang::ParmVarDecl *>
+BatchSynthesizer::getLaneParams(clang::FunctionDecl *Traversal) {
+  std::vector<clang::ParmVarDecl *> Params;
+  unsigned First = isa<clang::CXXMethodDecl>(Traversal) ? 0 : 1;
+  for (unsigned i = First; i < Traversal->getNumParams(); i++)
+    Params.push_back(Traversal->getParamDecl(i));
+  return Params;
+}
+
+std::string BatchSynthesizer::getLaneType(const clang::ParmVarDecl *Param) {
+  return Param->getType()
+      .getNonReferenceType()
+      .getUnqualifiedType()
+      .getAsString();
+}
+
+std::string
+BatchSynthesizer::getBatchName(const clang::FunctionDecl *Traversal) {
+  std::string Name = "_batch_" + Traversal->getQualifiedNameAsString();
+  for (size_t Pos = Name.find("::"); Pos != std::string::npos;
+       Pos = Name.find("::"))
+    Name.replace(Pos, 2, "_");
+  return Name;
+}
+
+std::string BatchSynthesizer::getBatchCall(clang::CallExpr *Call,
+                                           const std::string &Node,
+                                           const std::string &Lanes) {
+  auto *Callee = Call->getCalleeDecl()->getAsFunction();
+  auto *StaticType = getVisitedType(Call);
+  std::vector<const clang::CXXRecordDecl *> DynamicTypes;
+  auto Callees = getPossibleCallees(Callee, StaticType, &DynamicTypes);
+  for (int i = 0; i < Callees.size(); i++)
+    synthesizeTraversal(Callees[i], Call, DynamicTypes[i]);
+
+  if (!Callees[0]->isVirtual())
+    return getBatchName(Callees[0]->getFunctionDecl()) + "(" + Node + ", " +
+           Lanes + ")";
+
+  // the lanes of a call visit the same node, they are dispatched once to
+  // the batched version of the override of its dynamic type
+  std::string StubName = "_batch_" + Callee->getNameAsString();
+  std::string Params = "int _n", Arguments = "this, _n";
+  for (auto *Param : getLaneParams(Callee)) {
+    auto Index = to_string(Param->getFunctionScopeIndex());
+    Params += ", " + getLaneType(Param) + " *_a" + Index;
+    Arguments += ", _a" + Index;
+  }
+
+  bool HasStaticTypeStub = false;
+  for (int i = 0; i < Callees.size(); i++) {
+    auto *Type = DynamicTypes[i];
+    HasStaticTypeStub |= Type == StaticType;
+    if (!InsertedStubs.insert(make_pair(Type, StubName)).second)
+      continue;
+    Rewriter->InsertText(Type->getDefinition()->getEndLoc(),
+                         "public:\n" +
+                             string(Type == StaticType ? "virtual " : "") +
+                             "void " + StubName + "(" + Params + ")" +
+                             (Type == StaticType ? "" : " override") + ";\n");
+    Definitions += "void " + Type->getQualifiedNameAsString() +
+                   "::" + StubName + "(" + Params + ") {\n" +
+                   getBatchName(Callees[i]->getFunctionDecl()) + "(" +
+                   Arguments + ");\n}\n";
+  }
+  if (!HasStaticTypeStub &&
+      InsertedStubs.insert(make_pair(StaticType, StubName)).second)
+    Rewriter->InsertText(StaticType->getDefinition()->getEndLoc(),
+                         "public:\nvirtual void " + StubName + "(" + Params +
+                             ") = 0;\n");
+
+  return Node + "->" + StubName + "(" + Lanes + ")";
+}
+
+std::string BatchSynthesizer::getLaneGuard(StatementInfo *CallStmt,
+                                           const std::string &Node) {
+  auto *Call = dyn_cast<clang::CallExpr>(CallStmt->Stmt);
+  auto Callees = getPossibleCallees(Call->getCalleeDecl()->getAsFunction(),
+                                    getVisitedType(Call), nullptr);
+
+  // every non empty callee must start with the same guard
+  std::string GuardTemplate;
+  for (auto *Info : Callees) {
+    if (Info->hasEmptyBody())
+      continue;
+    if (Info->getGuardTemplate() == "" ||
+        (GuardTemplate != "" && GuardTemplate != Info->getGuardTemplate()))
+      return "";
+    GuardTemplate = Info->getGuardTemplate();
+  }
+
+  // the parameters are the values of the lane, or the node for the first
+  // parameter of global traversals
+  bool IsGlobal = !isa<clang::CXXMemberCallExpr>(Call);
+  std::string Guard;
+  for (unsigned i = 0; i < GuardTemplate.size(); i++) {
+    if (GuardTemplate[i] != '$') {
+      Guard += GuardTemplate[i];
+      continue;
+    }
+    unsigned ArgIdx = 0;
+    while (i + 1 < GuardTemplate.size() && isdigit(GuardTemplate[i + 1]))
+      ArgIdx = ArgIdx * 10 + (GuardTemplate[++i] - '0');
+    if (ArgIdx >= Call->getNumArgs())
+      return "";
+    Guard += (IsGlobal && ArgIdx == 0) ? "(" + Node + ")"
+                                       : "(_v" + to_string(ArgIdx) + ")";
+  }
+  return Guard;
+}
+
+void BatchSynthesizer::synthesizeTraversal(
+    FunctionAnalyzer *Traversal, clang::CallExpr *Call,
+    const clang::CXXRecordDecl *DynamicType) {
+  auto *Decl = Traversal->getFunctionDecl();
+  if (!Synthesized.insert(Decl).second)
+    return;
+
+  auto &SM = Ctx->getSourceManager();
+  auto LaneParams = getLaneParams(Decl);
+  auto *RootDecl = Traversal->isGlobal() ? Decl->getParamDecl(0) : nullptr;
+
+  std::string Signature =
+      "void " + getBatchName(Decl) + "(" +
+      (Traversal->isGlobal()
+           ? RootDecl->getType().getAsString()
+           : Traversal->getDeclAsCXXMethod()->getParent()
+                     ->getQualifiedNameAsString() +
+                 " *") +
+      " _r, int _n";
+  for (auto *Param : LaneParams)
+    Signature += ", " + getLaneType(Param) + " *_a" +
+                 to_string(Param->getFunctionScopeIndex());
+  Signature += ")";
+  Declarations += Signature + ";\n";
+
+  // References to the arguments of the current lane used by Code
+  auto getLaneAliases = [&](const std::string &Code) {
+    std::string Aliases;
+    for (auto *Param : LaneParams) {
+      std::string Name = "_f0_" + Param->getNameAsString();
+      if (Code.find(Name) != std::string::npos)
+        Aliases += getLaneType(Param) + " &" + Name + " = _a" +
+                   to_string(Param->getFunctionScopeIndex()) + "[_l];\n";
+    }
+    return Aliases;
+  };
+  const std::string LaneLoop =
+      "for (int _l = 0; _l < _n; _l++) {\nif (!_on[_l])\ncontinue;\n";
+
+  // Consecutive calls that do not depend on each other visit their children
+  // in parallel
+  std::unordered_map<StatementInfo *, DG_Node *> GraphNodes;
+  auto *Graph = DependenceAnalyzer().createDependenceGraph(
+      {Call}, Traversal->isVirtual(), DynamicType);
+  for (auto *Node : Graph->getNodes())
+    GraphNodes[Node->getStatementInfo()] = Node;
+  auto AreIndependent = [&](StatementInfo *Stmt1, StatementInfo *Stmt2) {
+    return !GraphNodes[Stmt1]->getSuccessors().count(GraphNodes[Stmt2]) &&
+           !GraphNodes[Stmt2]->getSuccessors().count(GraphNodes[Stmt1]);
+  };
+
+  auto &Statements = Traversal->getStatements();
+  bool HasReturn = any_of(Statements.begin(), Statements.end(),
+                          [](StatementInfo *Stmt) { return Stmt->hasReturn(); });
+  StatementPrinter Printer;
+  std::string Body =
+      Signature + " {\n_orchard_lanes<unsigned char> _on(_n, 1);\n" +
+      (HasReturn ? "int _live = _n;\n" : "");
+  for (int i = 0; i < Statements.size(); i++) {
+    auto *Stmt = Statements[i];
+
+    // A statement runs for all the active lanes, a return deactivates the
+    // lane
+    if (!Stmt->isCallStmt()) {
+      std::string Label = "_lane_end_" + to_string(i);
+      std::string Code =
+          Printer.printStmt(Stmt->Stmt, SM, RootDecl, Label, 0, true, false, 1);
+      Body += LaneLoop + getLaneAliases(Code);
+      if (!Stmt->hasReturn()) {
+        Body += Code + "}\n";
+        continue;
+      }
+      Body += "unsigned int truncate_flags = 1;\n" + Code + Label +
+              ":\nif (!(truncate_flags & 1)) {\n_on[_l] = 0;\n_live--;\n}\n}\n"
+              "if (!_live)\nreturn;\n";
+      continue;
+    }
+
+    std::vector<StatementInfo *> Group = {Stmt};
+    while (i + 1 < Statements.size() && Statements[i + 1]->isCallStmt() &&
+           all_of(Group.begin(), Group.end(), [&](StatementInfo *Member) {
+             return AreIndependent(Member, Statements[i + 1]);
+           }))
+      Group.push_back(Statements[++i]);
+
+    // The lanes that pass the guard of the callee are partitioned into the
+    // lanes of the child
+    std::vector<std::string> Calls;
+    for (auto *CallStmt : Group) {
+      auto *ChildCall = dyn_cast<clang::CallExpr>(CallStmt->Stmt);
+      auto *Callee = ChildCall->getCalleeDecl()->getAsFunction();
+      std::string Prefix = "_c" + to_string(CallStmt->getStatementId());
+      std::string Node = Printer.printStmt(getVisitedNode(ChildCall), SM,
+                                           RootDecl, "not-used", 0, true,
+                                           false, 1);
+
+      std::string Values, Pushes, Lanes = Prefix + "_n";
+      for (auto *Param : getLaneParams(Callee)) {
+        auto Index = to_string(Param->getFunctionScopeIndex());
+        Body += "_orchard_lanes<" + getLaneType(Param) + "> " + Prefix + "_" +
+                Index + ";\n";
+        Values += getLaneType(Param) + " _v" + Index + " = " +
+                  Printer.printStmt(
+                      ChildCall->getArg(Param->getFunctionScopeIndex()), SM,
+                      RootDecl, "not-used", 0, true, false, 1) +
+                  ";\n";
+        Pushes += Prefix + "_" + Index + ".push(_v" + Index + ");\n";
+        Lanes += ", " + Prefix + "_" + Index + ".data()";
+      }
+      std::string Guard = getLaneGuard(CallStmt, Node);
+      if (Guard != "")
+        Values += "if (" + Guard + ")\ncontinue;\n";
+      Body += "int " + Prefix + "_n = 0;\n" + LaneLoop +
+              getLaneAliases(Values) + Values + Pushes + Prefix + "_n++;\n}\n";
+
+      std::string BatchCall = getBatchCall(ChildCall, Node, Lanes);
+      Calls.push_back("if (" + Prefix + "_n)\n" + BatchCall + ";\n");
+      if (Group.size() > 1 && CallStmt != Group.back())
+        Calls.back() = "if (" + Prefix + "_n >= _ORCHARD_BATCH_SPAWN_MIN)\n" +
+                       "_ORCHARD_BATCH_SPAWN " + BatchCall + ";\nelse " +
+                       Calls.back();
+    }
+    for (auto &CallText : Calls)
+      Body += CallText;
+    if (Group.size() > 1)
+      Body += "_ORCHARD_BATCH_SYNC;\n";
+  }
+  Definitions += Body + "}\n";
+}
+
+void BatchSynthesizer::rewriteLoop(const BatchedLoop &Loop, int LoopId) {
+  auto &SM = Ctx->getSourceManager();
+  auto *Call = Loop.Call;
+  auto *Callee = Call->getCalleeDecl()->getAsFunction();
+  std::string Prefix = "_orchard_batch" + to_string(LoopId);
+
+  // The iterations record the arguments of their call in the lanes, the
+  // batch runs after the loop
+  std::string Before = "{\n", Pushes, Lanes = Prefix + "_n";
+  for (auto *Param : getLaneParams(Callee)) {
+    auto Index = to_string(Param->getFunctionScopeIndex());
+    Before += "_orchard_lanes<" + getLaneType(Param) + "> " + Prefix + "_" +
+              Index + ";\n";
+    Pushes += Prefix + "_" + Index + ".push(" +
+              getSourceText(Call->getArg(Param->getFunctionScopeIndex()), Ctx) +
+              "), ";
+    Lanes += ", " + Prefix + "_" + Index + ".data()";
+  }
+  Before += "int " + Prefix + "_n = 0;\n";
+
+  auto *VisitedNode = getVisitedNode(Call);
+  auto *Stripped = VisitedNode->IgnoreParenImpCasts();
+  std::string Node = isa<clang::CXXThisExpr>(Stripped)
+                         ? "this"
+                         : getSourceText(VisitedNode, Ctx);
+  if (!isa<clang::DeclRefExpr>(Stripped) && !isa<clang::CXXThisExpr>(Stripped))
+    Node = "(" + Node + ")";
+  if (!VisitedNode->getType()->isPointerType())
+    Node = "(&" + Node + ")";
+
+  std::string After = "\nif (" + Prefix + "_n)\n" +
+                      getBatchCall(Call, Node, Lanes) + ";\n}\n";
+
+  auto End = isa<clang::CompoundStmt>(Loop.Body)
+                 ? Lexer::getLocForEndOfToken(Loop.Loop->getEndLoc(), 0, SM,
+                                              Ctx->getLangOpts())
+                 : Lexer::findLocationAfterToken(Loop.Loop->getEndLoc(),
+                                                 tok::semi, SM,
+                                                 Ctx->getLangOpts(), false);
+  Rewriter->InsertTextBefore(Loop.Loop->getBeginLoc(), Before);
+  Rewriter->ReplaceText(Call->getSourceRange(),
+                        "(" + Pushes + Prefix + "_n++)");
+  Rewriter->InsertTextAfter(End, After);
+  RuntimeSupport::require(SM, Loop.Loop->getBeginLoc(), RuntimeSupport::Batch);
+
+  if (Declarations == "")
+    return;
+  Rewriter->InsertText(Loop.EnclosingFunctionDecl->getDefinition()
+                           ->getTypeSourceInfo()
+                           ->getTypeLoc()
+                           .getBeginLoc(),
+                       "//added by fuse transformer: batched traversals\n" +
+                           Declarations + Definitions);
+  Declarations = "";
+  Definitions = "";
+}
+
+void BatchSynthesizer::synthesize(clang::Rewriter &Rewriter) {
+  this->Rewriter = &Rewriter;
+  for (int i = 0; i < Loops.size(); i++)
+    rewriteLoop(Loops[i], i);
+}
@@ -0,0 +1,124 @@
+//===--- BatchSynthesizer.h -----------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Replaces the loops that call a batchable traversal once per iteration with
+// a single walk of the tree that carries the arguments of all the iterations
+// as lanes, and synthesizes the batched versions of the traversals.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_BATCH_SYNTHESIZER
+#define TREE_FUSER_BATCH_SYNTHESIZER
+
+#include "FunctionAnalyzer.h"
+#include "LLVMDependencies.h"
+#include <set>
+#include <string>
+#include <vector>
+
+class BatchSynthesizer : public clang::RecursiveASTVisitor<BatchSynthesizer> {
+private:
+  clang::ASTContext *Ctx;
+
+  /// Refers to the currently traversed function
+  clang::FunctionDecl *CurrentFuncDecl = nullptr;
+
+  /// A loop whose body is a single call to a batchable traversal
+  struct BatchedLoop {
+    clang::Stmt *Loop;
+    clang::Stmt *Body;
+    clang::CallExpr *Call;
+    clang::FunctionDecl *EnclosingFunctionDecl;
+  };
+
+  /// Batched loops in source order
+  std::vector<BatchedLoop> Loops;
+
+  /// Calls replaced by the batched loops, fusion skips them
+  static std::set<const clang::CallExpr *> BatchedCalls;
+
+  /// Traversals whose batched versions are already synthesized
+  static std::set<const clang::FunctionDecl *> Synthesized;
+
+  /// Virtual stubs already inserted in each tree class
+  static std::set<std::pair<const clang::CXXRecordDecl *, std::string>>
+      InsertedStubs;
+
+  /// Rewriter of the translation unit, set by synthesize
+  clang::Rewriter *Rewriter = nullptr;
+
+  /// Forward declarations, stubs and definitions of the batched traversals
+  /// synthesized for the current loop
+  std::string Declarations, Definitions;
+
+  /// Return true if the loop is a batch of calls of a batchable traversal and
+  /// record it
+  bool recordLoop(clang::Stmt *Loop, clang::Stmt *Body);
+
+  /// Return true if the traversals that the call and its callees reach can
+  /// all run over lanes
+  static bool canBatch(clang::CallExpr *Call);
+
+  /// Return the definitions that a call to Callee can dispatch to, one per
+  /// possible dynamic type of the visited node for virtual traversals
+  static std::vector<FunctionAnalyzer *>
+  getPossibleCallees(clang::FunctionDecl *Callee,
+                     const clang::CXXRecordDecl *StaticType,
+                     std::vector<const clang::CXXRecordDecl *> *DynamicTypes);
+
+  /// Return the parameters of the traversal that are carried by the lanes,
+  /// all of them but the visited node of global traversals
+  static std::vector<clang::ParmVarDecl *>
+  getLaneParams(clang::FunctionDecl *Traversal);
+
+  /// Return the type of the lane array of the parameter
+  static std::string getLaneType(const clang::ParmVarDecl *Param);
+
+  /// Return the name of the batched version of the traversal definition
+  static std::string getBatchName(const clang::FunctionDecl *Traversal);
+
+  /// Return a call of the batched version of Call on Node (a pointer) with
+  /// the given lanes, synthesizing the batched traversals that it reaches
+  std::string getBatchCall(clang::CallExpr *Call, const std::string &Node,
+                           const std::string &Lanes);
+
+  /// Synthesize the batched version of Traversal, with Call one of the calls
+  /// that reach it and DynamicType the type it is called on if it is virtual
+  void synthesizeTraversal(FunctionAnalyzer *Traversal, clang::CallExpr *Call,
+                           const clang::CXXRecordDecl *DynamicType);
+
+  /// Return the early return guard shared by all the callees of the call
+  /// statement evaluated on the arguments of a lane, with Node the visited
+  /// node, or an empty string
+  std::string getLaneGuard(StatementInfo *CallStmt, const std::string &Node);
+
+  /// Rewrite one batched loop
+  void rewriteLoop(const BatchedLoop &Loop, int LoopId);
+
+public:
+  BatchSynthesizer(clang::ASTContext *Ctx_) : Ctx(Ctx_) {}
+
+  /// Search the translation unit for the loops to batch
+  void findBatches() { TraverseDecl(Ctx->getTranslationUnitDecl()); }
+
+  /// Return true if the call is replaced by a batched loop
+  static bool isBatchedCall(const clang::CallExpr *Call) {
+    return BatchedCalls.count(Call);
+  }
+
+  /// Rewrite the batched loops and insert the batched traversals before
+  /// the functions that contain them
+  void synthesize(clang::Rewriter &Rewriter);
+
+  bool VisitFunctionDecl(clang::FunctionDecl *FuncDecl);
+
+  bool VisitForStmt(clang::ForStmt *Loop);
+
+  bool VisitCXXForRangeStmt(clang::CXXForRangeStmt *Loop);
+};
+
+#endif
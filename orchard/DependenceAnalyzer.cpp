@@ -166,7 +166,9 @@ void DependenceAnalyzer::addInterTraversalDependecies(
 
   for (auto *Stmt1 : Traversal1->getStatements()) {
 
-    if (opts::PrintAutomata) {
+    // each statement is printed once, not once per pair of traversals
+    static std::set<StatementInfo *> Printed;
+    if (opts::PrintAutomata && Printed.insert(Stmt1).second) {
       FSMUtility::print(Stmt1->getTreeWritesAutomata(),
                         (Traversal1->getFunctionDecl()->getNameAsString()) +
                             to_string(Stmt1->getStatementId()) + "w",
@@ -10,6 +10,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "DependenceGraph.h"
+#include "llvm/Support/raw_ostream.h"
 #include <stack>
 
 std::vector<DG_Node *> MergeInfo::getCallsOrdered() {
@@ -414,4 +415,228 @@ void DependenceGraph::mergeAllCalls() {
       merge(ChildAndCallers.second[i - 1], ChildAndCallers.second[i]);
     }
   }
-}
\ No newline at end of file
+}
+// Return the names of the dependence types of an edge
+static std::vector<std::string> getDependenceNames(const DependenceInfo &Info) {
+  std::vector<std::string> Names;
+  if (Info.GLOBAL_DEP)
+    Names.push_back("GLOBAL_DEP");
+  if (Info.LOCAL_DEP)
+    Names.push_back("LOCAL_DEP");
+  if (Info.ONTREE_DEP)
+    Names.push_back("ONTREE_DEP");
+  if (Info.ONTREE_DEP_FUSABLE)
+    Names.push_back("ONTREE_DEP_FUSABLE");
+  if (Info.CONTROL_DEP)
+    Names.push_back("CONTROL_DEP");
+  return Names;
+}
+
+// Return the source of a statement on one line, shortened to Limit characters
+static std::string getStatementText(StatementInfo *StmtInfo,
+                                    unsigned Limit = 60) {
+  std::string Text;
+  llvm::raw_string_ostream Stream(Text);
+  StmtInfo->Stmt->printPretty(Stream, nullptr,
+                              StmtInfo->getEnclosingFunction()
+                                  ->getFunctionDecl()
+                                  ->getASTContext()
+                                  .getPrintingPolicy());
+  std::string Line;
+  for (char C : Stream.str()) {
+    if (C == '\n' || C == '\t')
+      C = ' ';
+    if (C == ' ' && (Line.empty() || Line.back() == ' '))
+      continue;
+    Line += C;
+  }
+  while (!Line.empty() && Line.back() == ' ')
+    Line.pop_back();
+  if (Line.size() > Limit)
+    Line = Line.substr(0, Limit - 3) + "...";
+  return Line;
+}
+
+// Escape the quotes, backslashes and line breaks of a string literal
+static std::string escape(const std::string &Text) {
+  std::string Escaped;
+  for (char C : Text) {
+    if (C == '"' || C == '\\')
+      Escaped += '\\';
+    if (C == '\n') {
+      Escaped += "\\n";
+      continue;
+    }
+    Escaped += C;
+  }
+  return Escaped;
+}
+
+/// Numbering of the nodes, merges and levels shared by the exports
+struct GraphNumbering {
+  std::unordered_map<DG_Node *, int> NodeIds;
+  std::unordered_map<DG_Node *, int> NodeLevels;
+  std::vector<MergeInfo *> Merges;
+  std::unordered_map<MergeInfo *, int> MergeIds;
+
+  GraphNumbering(std::vector<DG_Node *> &Nodes,
+                 const std::vector<std::vector<DG_Node *>> &Levels) {
+    for (unsigned I = 0; I < Nodes.size(); I++) {
+      auto *Node = Nodes[I];
+      NodeIds[Node] = I;
+      if (Node->isMerged() && !MergeIds.count(Node->getMergeInfo())) {
+        MergeIds[Node->getMergeInfo()] = Merges.size();
+        Merges.push_back(Node->getMergeInfo());
+      }
+    }
+    // the schedule holds one node of each merge
+    for (unsigned Level = 0; Level < Levels.size(); Level++)
+      for (auto *Node : Levels[Level]) {
+        if (!Node->isMerged()) {
+          NodeLevels[Node] = Level;
+          continue;
+        }
+        for (auto *Merged : Node->getMergeInfo()->MergedNodes)
+          NodeLevels[Merged] = Level;
+      }
+  }
+
+  int getLevel(DG_Node *Node) {
+    return NodeLevels.count(Node) ? NodeLevels[Node] : -1;
+  }
+};
+
+void DependenceGraph::writeDot(
+    std::ostream &Output, const std::string &Name,
+    const std::vector<std::vector<DG_Node *>> &Levels) {
+  GraphNumbering Numbering(Nodes, Levels);
+
+  Output << "digraph \"" << escape(Name) << "\" {\n";
+  Output << "  node [shape = box, fontname = \"monospace\"];\n";
+
+  for (auto *Node : Nodes) {
+    auto *StmtInfo = Node->getStatementInfo();
+    Output << "  n" << Numbering.NodeIds[Node] << " [label = \"t"
+           << Node->getTraversalId() << " s" << StmtInfo->getStatementId()
+           << " level " << Numbering.getLevel(Node) << "\\n"
+           << escape(getStatementText(StmtInfo)) << "\""
+           << (StmtInfo->isCallStmt() ? ", style = rounded" : "") << "];\n";
+  }
+
+  for (unsigned I = 0; I < Numbering.Merges.size(); I++) {
+    auto *Child =
+        (*Numbering.Merges[I]->MergedNodes.begin())->getStatementInfo()
+            ->getCalledChild();
+    Output << "  subgraph cluster_merge" << I << " {\n";
+    Output << "    label = \"merged calls on "
+           << (Child ? Child->getNameAsString() : "this")
+           << "\";\n    style = dashed;\n";
+    for (auto *Node : Numbering.Merges[I]->MergedNodes)
+      Output << "    n" << Numbering.NodeIds[Node] << ";\n";
+    Output << "  }\n";
+  }
+
+  for (auto *Node : Nodes)
+    for (auto &Successor : Node->getSuccessors()) {
+      auto Names = getDependenceNames(Successor.second);
+      std::string Label;
+      for (auto &DepName : Names)
+        Label += (Label.empty() ? "" : ",") + DepName;
+      Output << "  n" << Numbering.NodeIds[Node] << " -> n"
+             << Numbering.NodeIds[Successor.first] << " [label = \"" << Label
+             << "\""
+             << (Successor.second.isNotFusable() ? "" : ", style = dashed")
+             << "];\n";
+    }
+
+  for (auto &Rollback : RolledBackMerges)
+    Output << "  n" << Numbering.NodeIds[Rollback.Node1] << " -> n"
+           << Numbering.NodeIds[Rollback.Node2]
+           << " [label = \"rolled back: " << Rollback.Reason
+           << "\", color = red, style = dotted, dir = none, constraint = "
+              "false];\n";
+
+  Output << "}\n";
+}
+
+void DependenceGraph::writeJSON(
+    std::ostream &Output, const std::string &Name,
+    const std::vector<std::vector<DG_Node *>> &Levels) {
+  GraphNumbering Numbering(Nodes, Levels);
+
+  Output << "{\n  \"function\": \"" << escape(Name) << "\",\n";
+
+  Output << "  \"nodes\": [";
+  for (auto *Node : Nodes) {
+    auto *StmtInfo = Node->getStatementInfo();
+    auto *Child = StmtInfo->isCallStmt() ? StmtInfo->getCalledChild() : nullptr;
+    Output << (Numbering.NodeIds[Node] ? "," : "") << "\n    {\"id\": "
+           << Numbering.NodeIds[Node]
+           << ", \"traversal\": " << Node->getTraversalId()
+           << ", \"statement\": " << StmtInfo->getStatementId()
+           << ", \"function\": \""
+           << escape(StmtInfo->getEnclosingFunction()
+                         ->getFunctionDecl()
+                         ->getQualifiedNameAsString())
+           << "\", \"call\": " << (StmtInfo->isCallStmt() ? "true" : "false")
+           << ", \"child\": "
+           << (Child ? "\"" + Child->getNameAsString() + "\"" : "null")
+           << ", \"merge\": "
+           << (Node->isMerged()
+                   ? to_string(Numbering.MergeIds[Node->getMergeInfo()])
+                   : "null")
+           << ", \"level\": " << Numbering.getLevel(Node) << ", \"text\": \""
+           << escape(getStatementText(StmtInfo, 200)) << "\"}";
+  }
+  Output << "\n  ],\n";
+
+  Output << "  \"edges\": [";
+  bool First = true;
+  for (auto *Node : Nodes)
+    for (auto &Successor : Node->getSuccessors()) {
+      Output << (First ? "" : ",") << "\n    {\"from\": "
+             << Numbering.NodeIds[Node]
+             << ", \"to\": " << Numbering.NodeIds[Successor.first]
+             << ", \"types\": [";
+      auto Names = getDependenceNames(Successor.second);
+      for (unsigned I = 0; I < Names.size(); I++)
+        Output << (I ? ", " : "") << "\"" << Names[I] << "\"";
+      Output << "]}";
+      First = false;
+    }
+  Output << "\n  ],\n";
+
+  Output << "  \"merges\": [";
+  for (unsigned I = 0; I < Numbering.Merges.size(); I++) {
+    Output << (I ? "," : "") << "\n    {\"id\": " << I << ", \"nodes\": [";
+    unsigned J = 0;
+    for (auto *Node : Numbering.Merges[I]->getCallsOrdered())
+      Output << (J++ ? ", " : "") << Numbering.NodeIds[Node];
+    Output << "]}";
+  }
+  Output << "\n  ],\n";
+
+  Output << "  \"rolled_back_merges\": [";
+  for (unsigned I = 0; I < RolledBackMerges.size(); I++)
+    Output << (I ? "," : "") << "\n    {\"nodes\": ["
+           << Numbering.NodeIds[RolledBackMerges[I].Node1] << ", "
+           << Numbering.NodeIds[RolledBackMerges[I].Node2]
+           << "], \"reason\": \"" << RolledBackMerges[I].Reason << "\"}";
+  Output << "\n  ],\n";
+
+  Output << "  \"levels\": [";
+  for (unsigned Level = 0; Level < Levels.size(); Level++) {
+    Output << (Level ? "," : "") << "\n    [";
+    unsigned J = 0;
+    for (auto *Node : Levels[Level]) {
+      if (!Node->isMerged()) {
+        Output << (J++ ? ", " : "") << Numbering.NodeIds[Node];
+        continue;
+      }
+      for (auto *Merged : Node->getMergeInfo()->getCallsOrdered())
+        Output << (J++ ? ", " : "") << Numbering.NodeIds[Merged];
+    }
+    Output << "]";
+  }
+  Output << "\n  ]\n}\n";
+}
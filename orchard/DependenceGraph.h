@@ -15,6 +15,7 @@
 #include "Logger.h"
 #include "StatementInfo.h"
 
+#include <ostream>
 #include <stack>
 #include <stdio.h>
 #include <unordered_map>
@@ -116,6 +117,13 @@ public:
   set<DG_Node *> getAllSuccessors();
 };
 
+/// A merge of two call nodes that the fusion undid, and why
+struct RolledBackMerge {
+  DG_Node *Node1;
+  DG_Node *Node2;
+  std::string Reason;
+};
+
 class DependenceGraph {
 private:
   bool hasCycleRec(DG_Node *Node, std::unordered_map<DG_Node *, int> &Visited,
@@ -123,6 +131,9 @@ private:
   /// Store all graph nodes
   std::vector<DG_Node *> Nodes;
 
+  /// Merges undone by the fusion, in the order they were tried
+  std::vector<RolledBackMerge> RolledBackMerges;
+
 public:
   std::vector<DG_Node *> &getNodes() { return Nodes; }
 
@@ -132,6 +143,21 @@ public:
 
   void dumpMergeInfo();
 
+  /// Record that the merge of Node2 into the merge of Node1 was undone
+  void recordRollback(DG_Node *Node1, DG_Node *Node2, std::string Reason) {
+    RolledBackMerges.push_back({Node1, Node2, Reason});
+  }
+
+  /// Write the graph of the fused function Name in the dot format, with its
+  /// dependences, its merges, the merges that were rolled back and the
+  /// parallel levels of the schedule
+  void writeDot(std::ostream &Output, const std::string &Name,
+                const std::vector<std::vector<DG_Node *>> &Levels);
+
+  /// Write the same information as writeDot as a JSON object
+  void writeJSON(std::ostream &Output, const std::string &Name,
+                 const std::vector<std::vector<DG_Node *>> &Levels);
+
   /// Merge two nodes in the graph
   void merge(DG_Node *Node1, DG_Node *Node2);
 
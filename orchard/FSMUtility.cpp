@@ -10,7 +10,9 @@
 //===----------------------------------------------------------------------===//
 #include <FSMUtility.h>
 #include <Logger.h>
+#include <PhaseTimer.h>
 #include <cstdlib>
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -88,6 +90,7 @@ void FSMUtility::addAnyTransition(FSM &Automata, int Src, int Dest) {
 
 bool FSMUtility::hasNonEmptyIntersection(const FSM &Automata1,
                                          const FSM &Automata2) {
+  PhaseTimer::Scope Timer("fsm-intersect");
   FSM Intersection;
   fst::Intersect(Automata1, Automata2, &Intersection);
   return !isEmpty(Intersection);
@@ -127,6 +130,18 @@ FSM *FSMUtility::CopyRootRemoved(const FSM &In) {
   return Out;
 }
 
+std::string FSMUtility::getLabelName(int Label) {
+  if (Label == 0)
+    return "eps";
+  if (Label == 1)
+    return "^root";
+  if (LabelToSymbol.count(Label) && LabelToSymbol[Label])
+    return LabelToSymbol[Label]->getNameAsString();
+  if (LabelToSymbol_Abst.count(Label))
+    return "loc<" + to_string(LabelToSymbol_Abst[Label]) + ">";
+  return to_string(Label);
+}
+
 void FSMUtility::print(const FSM &Automata, std::string FileName,
                        bool Simplify) {
 
@@ -137,50 +152,36 @@ void FSMUtility::print(const FSM &Automata, std::string FileName,
     return;
   }
 
-  system((string("rm ") + FileName + ".*").c_str());
-
-  if (!Simplify) {
-    Automata.Write(FileName + ".fst");
-  } else {
-    FSM Tmp, Tmp2, Tmp3, Tmp4;
+  const FSM *Printed = &Automata;
+  FSM Tmp, Tmp2, Tmp3;
+  if (Simplify) {
     fst::Union(&Tmp, Automata);
-    //  fst::Disambiguate(Automata, &Tmp);
     fst::RmEpsilon(&Tmp);
     fst::Minimize(&Tmp, &Tmp2, 0, true);
     fst::Disambiguate(Tmp, &Tmp3);
     fst::Minimize(&Tmp3, &Tmp2, 0, true);
-    // fst::Disambiguate(Tmp3, &Tmp4);
-    //  fst::Minimize(&Tmp4, &Tmp2, 0, true);
-
-    Tmp3.Write(FileName + ".fst");
+    Printed = &Tmp3;
   }
 
-  system((string("fstdraw ") + FileName + ".fst " + FileName + ".dot").c_str());
-
-  system(
-      (string("sed -i 's/") + "0:0" + +"/" + "eps" + "/g' " + FileName + ".dot")
-          .c_str());
-
-  // Replace labels with symbols
-  for (auto &Entry : LabelToSymbol) {
-    if (Entry.second) // avoid when nullptr (thisExpr)
-      system((string("sed -i 's/") + std::to_string(Entry.first) + ":" +
-              std::to_string(Entry.first) + "/" +
-              Entry.second->getNameAsString() + "/g' " + FileName + ".dot")
-                 .c_str());
+  // written directly in the dot format, with the labels replaced by the names
+  // of their symbols
+  std::ofstream Output(FileName + ".dot");
+  if (!Output.is_open()) {
+    Logger::getStaticLogger().logWarn("could not open " + FileName + ".dot");
+    return;
   }
-  for (auto &Entry : LabelToSymbol_Abst) {
-    if (Entry.second) // avoid when nullptr (thisExpr)
-      system((string("sed -i 's/") + std::to_string(Entry.first) + ":" +
-              std::to_string(Entry.first) + "/" + string("loc<") +
-              to_string(Entry.second) + ">" + "/g' " + FileName + ".dot")
-                 .c_str());
+  Output << "digraph \"" << FileName << "\" {\n";
+  Output << "  rankdir = LR;\n";
+  for (fst::StateIterator<FSM> State(*Printed); !State.Done(); State.Next()) {
+    int Id = State.Value();
+    bool Final = Printed->Final(Id) != fst::StdArc::Weight::Zero();
+    Output << "  " << Id << " [label = \"" << Id << "\", shape = "
+           << (Final ? "doublecircle" : "circle")
+           << (Id == Printed->Start() ? ", style = bold" : "") << "];\n";
+    for (fst::ArcIterator<FSM> Arc(*Printed, Id); !Arc.Done(); Arc.Next())
+      Output << "  " << Id << " -> " << Arc.Value().nextstate
+             << " [label = \"" << getLabelName(Arc.Value().ilabel)
+             << "\"];\n";
   }
-  system((string("sed -i 's/") + "1:1" + +"/" + "^root" + "/g' " + FileName +
-          ".dot")
-             .c_str());
-
-  system((string("dot -Tps  ") + FileName + ".dot  > " + FileName + ".ps")
-             .c_str());
-  // system((string("open ") + FileName + ".ps").c_str());
+  Output << "}\n";
 }
@@ -74,7 +74,10 @@ public:
   /// Return a copy of the automata with the root transition removed
   static FSM *CopyRootRemoved(const FSM &In);
 
-  /// Print the automata into a visual form
+  /// Return the name of the symbol of a label, as shown by print
+  static std::string getLabelName(int Label);
+
+  /// Write the automata in the dot format to FileName.dot
   static void print(const FSM &Automata, std::string FileName = "tmp",
                     bool Simplify = false);
 
@@ -0,0 +1,246 @@
+//===--- FieldLayout.cpp --------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "FieldLayout.h"
+#include "AccessPath.h"
+#include "Logger.h"
+#include "StatementInfo.h"
+#include <algorithm>
+#include <fstream>
+
+using namespace std;
+
+extern llvm::cl::OptionCategory TreeFuserCategory;
+namespace opts {
+llvm::cl::opt<std::string> FieldLayout(
+    "field-layout",
+    cl::desc("write to the given header a recommended layout of the tree "
+             "classes, that groups the fields accessed by the same fused "
+             "traversals and splits the fields that no fused traversal "
+             "accesses into a side structure"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned>
+    CacheLineSize("cache-line-size",
+                  cl::desc("the cache line size in bytes assumed by "
+                           "-field-layout"),
+                  cl::init(64), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+std::map<const clang::FieldDecl *, std::set<std::string>>
+    FieldLayoutAdvisor::Accesses =
+        std::map<const clang::FieldDecl *, std::set<std::string>>();
+
+std::map<const clang::FieldDecl *, unsigned> FieldLayoutAdvisor::AccessCounts =
+    std::map<const clang::FieldDecl *, unsigned>();
+
+std::map<std::string, std::vector<std::string>> FieldLayoutAdvisor::Traversals =
+    std::map<std::string, std::vector<std::string>>();
+
+void FieldLayoutAdvisor::recordField(const std::string &FunctionName,
+                                     const clang::FieldDecl *Field) {
+  if (!Field || !Field->getParent())
+    return;
+  Accesses[Field].insert(FunctionName);
+  AccessCounts[Field]++;
+}
+
+void FieldLayoutAdvisor::recordTraversal(
+    const std::string &FunctionName,
+    const std::vector<std::vector<DG_Node *>> &TopologicalOrder) {
+  if (opts::FieldLayout.empty() || Traversals.count(FunctionName))
+    return;
+
+  auto &Names = Traversals[FunctionName];
+  auto RecordStatement = [&](DG_Node *Node) {
+    auto *StmtInfo = Node->getStatementInfo();
+    string Name = StmtInfo->getEnclosingFunction()
+                      ->getFunctionDecl()
+                      ->getQualifiedNameAsString();
+    if (find(Names.begin(), Names.end(), Name) == Names.end())
+      Names.push_back(Name);
+
+    if (StmtInfo->isCallStmt())
+      recordField(FunctionName, StmtInfo->getCalledChild());
+
+    for (auto *Set : {&StmtInfo->getAccessPaths().getReadSet(),
+                      &StmtInfo->getAccessPaths().getWriteSet()}) {
+      for (auto *Path : *Set) {
+        if (!Path->isOnTree() || Path->isStrictAccessCall())
+          continue;
+        // the children followed by the access and the field of the reached
+        // node
+        int End = Path->hasValuePart() ? Path->getValueStartIndex()
+                                       : Path->getDepth() - 1;
+        for (int I = 1; I <= End; I++)
+          recordField(FunctionName,
+                      dyn_cast<clang::FieldDecl>(Path->getDeclAtIndex(I)));
+      }
+    }
+  };
+
+  for (auto &Level : TopologicalOrder)
+    for (auto *Node : Level) {
+      if (Node->isMerged())
+        for (auto *Merged : Node->getMergeInfo()->MergedNodes)
+          RecordStatement(Merged);
+      else
+        RecordStatement(Node);
+    }
+}
+
+// Return the number of cache lines touched by the given [offset, size) ranges
+static unsigned
+countCacheLines(const std::vector<std::pair<uint64_t, uint64_t>> &Ranges) {
+  std::set<uint64_t> Lines;
+  for (auto &Range : Ranges)
+    for (uint64_t Line = Range.first / opts::CacheLineSize;
+         Line <= (Range.first + std::max<uint64_t>(Range.second, 1) - 1) /
+                     opts::CacheLineSize;
+         Line++)
+      Lines.insert(Line);
+  return Lines.size();
+}
+
+std::string
+FieldLayoutAdvisor::createRecordRecommendation(const clang::RecordDecl *Record) {
+  auto &Ctx = Record->getASTContext();
+  auto &Layout = Ctx.getASTRecordLayout(Record);
+  string Name = Record->getNameAsString();
+
+  // hot fields grouped by the exact set of fused traversals that access them
+  std::map<std::set<std::string>, std::vector<const clang::FieldDecl *>> Groups;
+  std::vector<const clang::FieldDecl *> Cold;
+  std::vector<std::pair<uint64_t, uint64_t>> CurrentRanges;
+  uint64_t Start = 0;
+  bool First = true;
+  for (auto *Field : Record->fields()) {
+    uint64_t Offset = Ctx.toCharUnitsFromBits(
+                             Layout.getFieldOffset(Field->getFieldIndex()))
+                          .getQuantity();
+    if (First)
+      Start = Offset;
+    First = false;
+    if (!Accesses.count(Field)) {
+      Cold.push_back(Field);
+      continue;
+    }
+    Groups[Accesses[Field]].push_back(Field);
+    CurrentRanges.push_back(
+        {Offset, Ctx.getTypeSizeInChars(Field->getType()).getQuantity()});
+  }
+
+  // the fields shared by more traversals, then the most accessed, come first
+  std::vector<std::pair<std::set<std::string>,
+                        std::vector<const clang::FieldDecl *>>>
+      Ordered(Groups.begin(), Groups.end());
+  auto Weight = [&](const std::vector<const clang::FieldDecl *> &Fields) {
+    unsigned Count = 0;
+    for (auto *Field : Fields)
+      Count += AccessCounts[Field];
+    return Count;
+  };
+  std::stable_sort(Ordered.begin(), Ordered.end(),
+                   [&](const decltype(Ordered)::value_type &LHS,
+                       const decltype(Ordered)::value_type &RHS) {
+                     if (LHS.first.size() != RHS.first.size())
+                       return LHS.first.size() > RHS.first.size();
+                     return Weight(LHS.second) > Weight(RHS.second);
+                   });
+
+  string Text = "// class " + Name + "\n";
+  std::vector<std::pair<uint64_t, uint64_t>> RecommendedRanges;
+  string HotList = "";
+  uint64_t Offset = Start;
+  for (auto &Group : Ordered) {
+    // larger alignments first to avoid padding within the group
+    auto Fields = Group.second;
+    std::stable_sort(Fields.begin(), Fields.end(),
+                     [&](const clang::FieldDecl *LHS,
+                         const clang::FieldDecl *RHS) {
+                       return Ctx.getTypeAlignInChars(LHS->getType()) >
+                              Ctx.getTypeAlignInChars(RHS->getType());
+                     });
+    Text += "//   accessed by";
+    for (auto &Function : Group.first)
+      Text += " " + Function;
+    Text += ":";
+    for (auto *Field : Fields) {
+      uint64_t Align =
+          Ctx.getTypeAlignInChars(Field->getType()).getQuantity();
+      uint64_t Size = Ctx.getTypeSizeInChars(Field->getType()).getQuantity();
+      Offset = (Offset + Align - 1) / Align * Align;
+      RecommendedRanges.push_back({Offset, Size});
+      Offset += Size;
+      Text += " " + Field->getNameAsString();
+      HotList += " X(" + Field->getNameAsString() + ")";
+    }
+    Text += "\n";
+  }
+  Text += "//   hot fields span " + to_string(countCacheLines(CurrentRanges)) +
+          " cache line(s), " + to_string(countCacheLines(RecommendedRanges)) +
+          " in the recommended order\n";
+
+  Text += "#define ORCHARD_" + Name + "_HOT_FIELDS(X)" + HotList + "\n";
+  if (Cold.empty())
+    return Text + "\n";
+
+  auto Policy = Ctx.getPrintingPolicy();
+  Text += "/// Fields of " + Name +
+          " that no fused traversal accesses, to be reached through a "
+          "pointer\nstruct " +
+          Name + "_cold {\n";
+  for (auto *Field : Cold) {
+    string Declaration;
+    llvm::raw_string_ostream Stream(Declaration);
+    Field->getType().print(Stream, Policy, Field->getNameAsString());
+    Text += "  " + Stream.str() + ";\n";
+  }
+  return Text + "};\n\n";
+}
+
+void FieldLayoutAdvisor::writeRecommendation() {
+  if (opts::FieldLayout.empty())
+    return;
+
+  std::ofstream Output(opts::FieldLayout);
+  if (!Output.is_open()) {
+    Logger::getStaticLogger().logWarn("could not open the layout header " +
+                                      opts::FieldLayout);
+    return;
+  }
+
+  Output << "//added by fuse transformer: recommended layout of the tree "
+            "classes\n";
+  Output << "// The fields of each class are grouped by the fused traversals "
+            "that\n// access them, keep the groups together and in this "
+            "order.\n\n";
+  Output << "#ifndef ORCHARD_FIELD_LAYOUT_H\n#define ORCHARD_FIELD_LAYOUT_H\n\n";
+
+  for (auto &Entry : Traversals) {
+    Output << "// " << Entry.first << " fuses";
+    for (auto &Name : Entry.second)
+      Output << " " << Name;
+    Output << "\n";
+  }
+  Output << "\n";
+
+  // classes by name, a class seen by several translation units once
+  std::map<std::string, const clang::RecordDecl *> Records;
+  for (auto &Entry : Accesses) {
+    auto *Record = Entry.first->getParent();
+    Records.insert({Record->getQualifiedNameAsString(), Record});
+  }
+  for (auto &Entry : Records)
+    if (!Entry.second->isDependentType())
+      Output << createRecordRecommendation(Entry.second);
+
+  Output << "#endif\n";
+}
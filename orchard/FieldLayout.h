@@ -0,0 +1,54 @@
+//===--- FieldLayout.h ----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Collects the fields that each fused traversal accesses and recommends a
+// layout for the tree classes, with the hot fields grouped by the traversals
+// that access them and the cold fields split into a side structure.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_FIELD_LAYOUT
+#define TREE_FUSER_FIELD_LAYOUT
+
+#include "DependenceGraph.h"
+#include "LLVMDependencies.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class FieldLayoutAdvisor {
+public:
+  /// Record the fields accessed by the statements of the fused traversal
+  /// FunctionName, TopologicalOrder is its schedule
+  static void
+  recordTraversal(const std::string &FunctionName,
+                  const std::vector<std::vector<DG_Node *>> &TopologicalOrder);
+
+  /// Write the recommended layout header to the file given by -field-layout,
+  /// if any
+  static void writeRecommendation();
+
+private:
+  /// The fused traversals that access each field
+  static std::map<const clang::FieldDecl *, std::set<std::string>> Accesses;
+
+  /// Number of statements of the fused traversals that access each field
+  static std::map<const clang::FieldDecl *, unsigned> AccessCounts;
+
+  /// Participating traversals of each fused traversal
+  static std::map<std::string, std::vector<std::string>> Traversals;
+
+  /// Record an access to Field by the fused traversal FunctionName
+  static void recordField(const std::string &FunctionName,
+                          const clang::FieldDecl *Field);
+
+  /// Return the recommendation text for one tree class
+  static std::string createRecordRecommendation(const clang::RecordDecl *Record);
+};
+
+#endif
@@ -14,12 +14,73 @@
 #include "Logger.h"
 #include "RecordAnalyzer.h"
 
+#include <fstream>
+#include <map>
 #include <set>
 #include <sstream>
 #include <string>
 #include <utility>
 #include <vector>
 
+extern llvm::cl::OptionCategory TreeFuserCategory;
+namespace opts {
+llvm::cl::opt<std::string> StmtCostProfile(
+    "stmt-cost-profile",
+    cl::desc("a file that lists the cost of helper functions called from "
+             "traversals, one \"<qualified name> <cost>\" entry per line"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+llvm::cl::opt<unsigned>
+    HeavyStmtCost("heavy-stmt-cost",
+                  cl::desc("the profiled cost from which a statement that "
+                           "calls a helper is spawned as its own task"),
+                  cl::init(1000), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+// Return the cost of the function in the cost profile, 0 if not profiled
+static unsigned getProfiledCost(const clang::FunctionDecl *Function) {
+  static std::map<std::string, unsigned> Costs = [] {
+    std::map<std::string, unsigned> Costs;
+    if (opts::StmtCostProfile.empty())
+      return Costs;
+
+    std::ifstream Profile(opts::StmtCostProfile);
+    if (!Profile.is_open()) {
+      Logger::getStaticLogger().logWarn("could not open the cost profile " +
+                                        opts::StmtCostProfile);
+      return Costs;
+    }
+    std::string Line;
+    while (std::getline(Profile, Line)) {
+      std::istringstream Entry(Line);
+      std::string Name;
+      unsigned Cost;
+      if (Line.empty() || Line[0] == '#' || !(Entry >> Name >> Cost))
+        continue;
+      Costs[Name] = Cost;
+    }
+    return Costs;
+  }();
+
+  auto It = Costs.find(Function->getQualifiedNameAsString());
+  return It == Costs.end() ? 0 : It->second;
+}
+
+// Return true if the statement calls a helper that is annotated with tf_heavy
+// or whose profiled cost reaches the heavy statement threshold
+static bool callsHeavyHelper(const clang::Stmt *Stmt) {
+  if (auto *Call = dyn_cast<clang::CallExpr>(Stmt)) {
+    if (auto *Callee = Call->getDirectCallee()) {
+      if (hasHeavyAnnotation(Callee) ||
+          getProfiledCost(Callee) >= opts::HeavyStmtCost)
+        return true;
+    }
+  }
+  for (auto *Child : Stmt->children())
+    if (Child && callsHeavyHelper(Child))
+      return true;
+  return false;
+}
+
 void FunctionAnalyzer::dump() {
   outs() << "isValidFuse:" << isValidFuse() << "\n";
   for (auto *Stmt : Statements) {
@@ -385,8 +446,130 @@ bool FunctionAnalyzer::checkFuseSema() {
   assert(FuncDeclNode->getBody()->IgnoreImplicit()->getStmtClass() ==
          clang::Stmt::CompoundStmtClass);
 
-  return collectAccessPath_VisitCompoundStmt(
-      dyn_cast<clang::CompoundStmt>(FuncDeclNode->getBody()));
+  if (!collectAccessPath_VisitCompoundStmt(
+          dyn_cast<clang::CompoundStmt>(FuncDeclNode->getBody())))
+    return false;
+
+  findGuard();
+  return true;
+}
+
+bool FunctionAnalyzer::hasEmptyBody() const {
+  return dyn_cast<clang::CompoundStmt>(FuncDeclNode->getBody())->body_empty();
+}
+
+// Print a guard condition that only uses parameters, literals and enumerators
+// with the parameters replaced by $<index>. Return false for anything else.
+static bool printGuardTemplate(const clang::Expr *Expr,
+                               const clang::FunctionDecl *FuncDecl,
+                               std::string &Output) {
+  Expr = Expr->IgnoreImpCasts();
+  switch (Expr->getStmtClass()) {
+  case clang::Stmt::ParenExprClass:
+    Output += "(";
+    if (!printGuardTemplate(dyn_cast<clang::ParenExpr>(Expr)->getSubExpr(),
+                            FuncDecl, Output))
+      return false;
+    Output += ")";
+    return true;
+
+  case clang::Stmt::BinaryOperatorClass: {
+    auto *BinaryOperator = dyn_cast<clang::BinaryOperator>(Expr);
+    if (BinaryOperator->isAssignmentOp() ||
+        BinaryOperator->getOpcode() == clang::BO_Comma)
+      return false;
+    if (!printGuardTemplate(BinaryOperator->getLHS(), FuncDecl, Output))
+      return false;
+    Output += " " + BinaryOperator->getOpcodeStr().str() + " ";
+    return printGuardTemplate(BinaryOperator->getRHS(), FuncDecl, Output);
+  }
+
+  case clang::Stmt::UnaryOperatorClass: {
+    auto *UnaryOperator = dyn_cast<clang::UnaryOperator>(Expr);
+    switch (UnaryOperator->getOpcode()) {
+    case clang::UO_LNot:
+    case clang::UO_Not:
+    case clang::UO_Minus:
+    case clang::UO_Plus:
+      Output += clang::UnaryOperator::getOpcodeStr(UnaryOperator->getOpcode());
+      return printGuardTemplate(UnaryOperator->getSubExpr(), FuncDecl, Output);
+    default:
+      return false;
+    }
+  }
+
+  case clang::Stmt::DeclRefExprClass: {
+    auto *Decl = dyn_cast<clang::DeclRefExpr>(Expr)->getDecl();
+    if (auto *EnumConstant = dyn_cast<clang::EnumConstantDecl>(Decl)) {
+      Output += EnumConstant->getQualifiedNameAsString();
+      return true;
+    }
+    for (unsigned i = 0; i < FuncDecl->getNumParams(); i++) {
+      if (FuncDecl->getParamDecl(i) == Decl) {
+        Output += "$" + to_string(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  case clang::Stmt::IntegerLiteralClass:
+    Output += dyn_cast<clang::IntegerLiteral>(Expr)->getValue().toString(10,
+                                                                        true);
+    return true;
+
+  case clang::Stmt::CXXBoolLiteralExprClass:
+    Output += dyn_cast<clang::CXXBoolLiteralExpr>(Expr)->getValue() ? "true"
+                                                                    : "false";
+    return true;
+
+  case clang::Stmt::CXXNullPtrLiteralExprClass:
+  case clang::Stmt::GNUNullExprClass:
+    Output += "nullptr";
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+void FunctionAnalyzer::findGuard() {
+  GuardTemplate = "";
+
+  // skip the declarations without initializers at the start of the body
+  for (auto *Stmt : dyn_cast<clang::CompoundStmt>(FuncDeclNode->getBody())
+                        ->body()) {
+    if (auto *DeclStmt = dyn_cast<clang::DeclStmt>(Stmt)) {
+      bool HasInit = false;
+      for (auto *Decl : DeclStmt->decls()) {
+        auto *VarDecl = dyn_cast<clang::VarDecl>(Decl);
+        HasInit |= !VarDecl || VarDecl->hasInit();
+      }
+      if (HasInit)
+        return;
+      continue;
+    }
+
+    auto *IfStmt = dyn_cast<clang::IfStmt>(Stmt);
+    if (!IfStmt || IfStmt->getElse() || IfStmt->getInit() ||
+        IfStmt->getConditionVariable())
+      return;
+
+    auto *Then = IfStmt->getThen();
+    if (auto *ThenBlock = dyn_cast<clang::CompoundStmt>(Then)) {
+      if (ThenBlock->size() != 1)
+        return;
+      Then = ThenBlock->body_front();
+    }
+    auto *Return = dyn_cast<clang::ReturnStmt>(Then);
+    if (!Return || Return->getRetValue())
+      return;
+
+    std::string Template;
+    if (printGuardTemplate(IfStmt->getCond(), FuncDeclNode, Template))
+      GuardTemplate = Template;
+    return;
+  }
 }
 
 void FunctionAnalyzer::addAccessPath(AccessPath *AccessPath, bool IsWrite) {
@@ -714,6 +897,13 @@ bool FunctionAnalyzer::collectAccessPath_VisitCompoundStmt(
 
     if (!collectAccessPath_handleStmt(ChildStmt))
       return false;
+
+    // Heavy statements are spawned inside a lambda, so they can not jump out
+    // of it or declare variables used by later statements
+    if (NestedIfDepth == 0 && !CurrStatementInfo->isCallStmt() &&
+        !CurrStatementInfo->hasReturn() &&
+        ChildStmt->getStmtClass() != clang::Stmt::DeclStmtClass)
+      CurrStatementInfo->setHeavy(callsHeavyHelper(ChildStmt));
   }
 
   return true;
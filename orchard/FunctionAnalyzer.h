@@ -55,6 +55,10 @@ private:
   /// Store the result of the semantics check
   bool SemanticsSatasified = true;
 
+  /// The condition of a leading "if (cond) return;" that only depends on the
+  /// parameters, parameters are written as $<index>. Empty if there is none
+  std::string GuardTemplate;
+
   /// Pointer to the currently analyzed statment within the function
   StatementInfo *CurrStatementInfo = nullptr;
 
@@ -92,6 +96,10 @@ private:
 
   bool collectAccessPath_VisitCXXDeleteExpr(clang::CXXDeleteExpr *Expr);
 
+  /// Detect an early return guard at the start of the body and set
+  /// GuardTemplate
+  void findGuard();
+
 public:
   bool isVirtual() {
     if (isGlobal())
@@ -147,6 +155,13 @@ public:
 
   void setValidFuse(bool IsValid) { SemanticsSatasified = IsValid; }
 
+  /// Return the early return guard of the function, written in terms of the
+  /// parameters ($<index>), or an empty string
+  const std::string &getGuardTemplate() const { return GuardTemplate; }
+
+  /// Return true if the body of the function is empty
+  bool hasEmptyBody() const;
+
   int getNumberOfTraversingCalls() const;
 
   clang::FunctionDecl *getFunctionDecl() const;
@@ -11,7 +11,10 @@
 #include "FuseTransformation.h"
 #include "DependenceAnalyzer.h"
 #include "DependenceGraph.h"
+#include "PhaseTimer.h"
+#include "llvm/Support/FileSystem.h"
 #include <algorithm>
+#include <fstream>
 
 extern llvm::cl::OptionCategory TreeFuserCategory;
 namespace opts {
@@ -24,6 +27,17 @@ llvm::cl::opt<unsigned>
     MaxMergedNodes("max-merged-n",
                    cl::desc("a maximum number of  that can be fused together"),
                    cl::init(5), cl::ZeroOrMore, cl::cat(TreeFuserCategory));
+llvm::cl::opt<bool> ParallelizeSingleCalls(
+    "parallelize-single-calls",
+    cl::desc("generate parallel code for top level traversal calls that have "
+             "no fusion partner and visit independent children"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+llvm::cl::opt<std::string> ExportGraphs(
+    "export-graphs",
+    cl::desc("write the dependence graph of each synthesized function to the "
+             "given directory as <function>.dot and <function>.json, with the "
+             "merges taken, the merges rolled back and the parallel levels"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
 } // namespace opts
 
 bool FusionCandidatesFinder::VisitFunctionDecl(clang::FunctionDecl *FuncDecl) {
@@ -35,45 +49,96 @@ clang::Rewriter FusionTransformer::Rewriter = clang::Rewriter();
 DependenceAnalyzer FusionTransformer::DepAnalyzer = DependenceAnalyzer();
 TraversalSynthesizer *FusionTransformer::Synthesizer = nullptr;
 
+// Return true if the dependence graph of the traversal that the call reaches,
+// for one of the types it can dispatch to, has a parallel level with at least
+// two calls, so that the synthesized traversal visits children in parallel
+static bool hasIndependentChildCalls(clang::CallExpr *Call) {
+  auto *Callee = dyn_cast<clang::FunctionDecl>(Call->getCalleeDecl());
+  if (!Callee || !Callee->getDefinition() ||
+      !FunctionsFinder::FunctionsInformation.count(Callee->getDefinition()))
+    return false;
+  auto *Info = FunctionsFinder::getFunctionInfo(Callee->getDefinition());
+
+  std::vector<const clang::CXXRecordDecl *> Types = {nullptr};
+  if (Info->isVirtual()) {
+    auto *Method = Info->getDeclAsCXXMethod();
+    Types = {Method->getParent()};
+    for (auto *DerivedType :
+         RecordsAnalyzer::DerivedRecords[Method->getParent()])
+      Types.push_back(DerivedType);
+  }
+
+  for (auto *Type : Types) {
+    if (Type) {
+      auto *Override =
+          Info->getDeclAsCXXMethod()->getCorrespondingMethodInClass(Type);
+      if (!Override || !Override->getDefinition() ||
+          !FunctionsFinder::FunctionsInformation.count(
+              Override->getDefinition()))
+        continue;
+    }
+    auto *DepGraph = DependenceAnalyzer().createDependenceGraph(
+        {Call}, Type != nullptr, Type);
+    for (auto &Level : FusionTransformer::parallelSchedule(DepGraph)) {
+      int Calls = 0;
+      for (auto *Node : Level)
+        if (Node->getStatementInfo()->isCallStmt())
+          Calls++;
+      if (Calls > 1)
+        return true;
+    }
+  }
+  return false;
+}
+
+bool FusionCandidatesFinder::isParallelizableSingleCall(
+    clang::CallExpr *Call) {
+  // calls within traversals are already part of the traversal's own code
+  if (!opts::ParallelizeSingleCalls || hasFuseAnnotation(CurrentFuncDecl))
+    return false;
+
+  return hasIndependentChildCalls(Call);
+}
+
 bool FusionCandidatesFinder::VisitCompoundStmt(
     const CompoundStmt *CompoundStmt) {
 
   std::vector<clang::CallExpr *> Candidate;
 
-  for (auto *InnerStmt : CompoundStmt->body()) {
+  auto RecordCandidate = [&]() {
+    if (Candidate.size() > 1 ||
+        (Candidate.size() == 1 && isParallelizableSingleCall(Candidate[0])))
+      FusionCandidates[CurrentFuncDecl].push_back(Candidate);
 
-    if (InnerStmt->getStmtClass() != Stmt::CallExprClass &&
-        InnerStmt->getStmtClass() != Stmt::CXXMemberCallExprClass) {
+    Candidate.clear();
+  };
 
-      if (Candidate.size() > 1)
-        FusionCandidates[CurrentFuncDecl].push_back(Candidate);
+  for (auto *InnerStmt : CompoundStmt->body()) {
 
-      Candidate.clear();
+    // calls batched over the iterations of their loop are not fused
+    if ((InnerStmt->getStmtClass() != Stmt::CallExprClass &&
+         InnerStmt->getStmtClass() != Stmt::CXXMemberCallExprClass) ||
+        BatchSynthesizer::isBatchedCall(dyn_cast<clang::CallExpr>(InnerStmt))) {
+      RecordCandidate();
       continue;
     }
 
     auto *CurrentCallStmt = dyn_cast<clang::CallExpr>(InnerStmt);
-    if (Candidate.size() == 0) {
-      if (areCompatibleCalls(CurrentCallStmt, CurrentCallStmt)) {
-        Candidate.push_back(CurrentCallStmt);
-      }
+    if (Candidate.size() != 0 &&
+        areCompatibleCalls(Candidate[0], CurrentCallStmt)) {
+      Candidate.push_back(CurrentCallStmt);
       continue;
     }
 
-    if (areCompatibleCalls(Candidate[0], CurrentCallStmt)) {
+    // the call ends the current candidate, it only starts a new one with
+    // -parallelize-single-calls, otherwise it is left unfused
+    RecordCandidate();
+    if (opts::ParallelizeSingleCalls &&
+        areCompatibleCalls(CurrentCallStmt, CurrentCallStmt))
       Candidate.push_back(CurrentCallStmt);
-    } else {
-      if (Candidate.size() > 1) //==1
-        FusionCandidates[CurrentFuncDecl].push_back(Candidate);
-
-      Candidate.clear();
-    }
   }
 
-  if (Candidate.size() > 1)
-    FusionCandidates[CurrentFuncDecl].push_back(Candidate);
-
-  Candidate.clear();
+  RecordCandidate();
   return true;
 }
 
@@ -168,8 +233,12 @@ void FusionTransformer::performFusion(
 
       Logger::getStaticLogger().logInfo("Creating DG for a candidate");
 
-      DependenceGraph *DepGraph =
-          DepAnalyzer.createDependenceGraph(Candidate, HasVirtual, DerivedType);
+      DependenceGraph *DepGraph;
+      {
+        PhaseTimer::Scope Timer("createDependenceGraph");
+        DepGraph = DepAnalyzer.createDependenceGraph(Candidate, HasVirtual,
+                                                     DerivedType);
+      }
 
       // added this part to perform coarse grained fusion.
       // for(auto *Node : DepGraph->getNodes()) {s
@@ -233,6 +302,7 @@ void FusionTransformer::performFusion(
       //           temp.swap(parallel);
 
       if (Heuristic != "solely-parallel") {
+        PhaseTimer::Scope Timer("performGreedyFusion");
         performGreedyFusion(DepGraph);
       }
       // }
@@ -244,11 +314,35 @@ void FusionTransformer::performFusion(
 
       // std::vector<DG_Node *> ToplogicalOrder = findToplogicalOrder(DepGraph);
       // //uncomment with recursion toposort
-      std::vector<vector<DG_Node *>> ToplogicalOrder =
-          parallelSchedule(DepGraph); // for the queue implementation
+      std::vector<vector<DG_Node *>> ToplogicalOrder;
+      {
+        PhaseTimer::Scope Timer("parallelSchedule");
+        ToplogicalOrder =
+            parallelSchedule(DepGraph); // for the queue implementation
+      }
 
-      Synthesizer->generateWriteBackInfo(Candidate, ToplogicalOrder, HasVirtual,
-                                         HasCXXMethod, DerivedType);
+      if (!opts::ExportGraphs.empty()) {
+        string Name = Synthesizer->createName(Candidate, HasVirtual,
+                                              DerivedType);
+        llvm::sys::fs::create_directories(opts::ExportGraphs);
+        std::ofstream Dot(opts::ExportGraphs + "/" + Name + ".dot");
+        std::ofstream JSON(opts::ExportGraphs + "/" + Name + ".json");
+        if (!Dot.is_open() || !JSON.is_open()) {
+          Logger::getStaticLogger().logWarn(
+              "could not write the graphs of " + Name + " to " +
+              opts::ExportGraphs);
+        } else {
+          DepGraph->writeDot(Dot, Name, ToplogicalOrder);
+          DepGraph->writeJSON(JSON, Name, ToplogicalOrder);
+        }
+      }
+
+      {
+        PhaseTimer::Scope Timer("generateWriteBackInfo");
+        Synthesizer->generateWriteBackInfo(Candidate, ToplogicalOrder,
+                                           HasVirtual, HasCXXMethod,
+                                           DerivedType);
+      }
       // added please remove if necessary !!!!!!!
       /////////////////////////////////////////////////////////////////////////////////////
       /*Synthesizer->generateWriteBackInfo_serial(Candidate, ToplogicalOrder,
@@ -411,16 +505,21 @@ void FusionTransformer::performGreedyFusion(DependenceGraph *DepGraph) {
           return false;
         };
 
+        std::string Reason;
         if (CallNodes[i]->getMergeInfo()->MergedNodes.size() >
-                opts::MaxMergedNodes ||
-            ReachMaxMerged(CallNodes[i]->getMergeInfo()) ||
-            DepGraph->hasCycle() ||
-            DepGraph->hasWrongFuse(CallNodes[i]->getMergeInfo())) {
-          LLVM_DEBUG(outs()
-                     << "rollback on merge, " << DepGraph->hasCycle() << ","
-                     << DepGraph->hasWrongFuse(CallNodes[i]->getMergeInfo())
-                     << "\n");
-
+            opts::MaxMergedNodes)
+          Reason = "max-merged-n";
+        else if (ReachMaxMerged(CallNodes[i]->getMergeInfo()))
+          Reason = "max-merged-f";
+        else if (DepGraph->hasCycle())
+          Reason = "cycle";
+        else if (DepGraph->hasWrongFuse(CallNodes[i]->getMergeInfo()))
+          Reason = "wrong-fuse";
+
+        if (!Reason.empty()) {
+          LLVM_DEBUG(outs() << "rollback on merge, " << Reason << "\n");
+
+          DepGraph->recordRollback(CallNodes[i], CallNodes[j], Reason);
           DepGraph->unmerge(CallNodes[j]);
         }
       }
@@ -561,7 +660,9 @@ FusionTransformer::parallelSchedule(DependenceGraph *DepGraph) {
     for (auto it = readyList.begin(); it != readyList.end();) {
       auto *Node = *it;
       auto *stmInfo = Node->getStatementInfo();
-      if (stmInfo->isCallStmt()) {
+      // heavy statements are scheduled with the calls so they can run as
+      // parallel tasks
+      if (stmInfo->isCallStmt() || stmInfo->isHeavy()) {
         it++;
         continue;
       }
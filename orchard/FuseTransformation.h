@@ -12,10 +12,13 @@
 #define TREE_FUSER_FUSE_TRANSFORMATION
 
 #include "AccessPath.h"
+#include "BatchSynthesizer.h"
 #include "DependenceAnalyzer.h"
 #include "FunctionAnalyzer.h"
 #include "FunctionsFinder.h"
 #include "LLVMDependencies.h"
+#include "RuntimeSupport.h"
+#include "TreeLayout.h"
 #include <TraversalSynthesizer.h>
 #include <set>
 #include <stdio.h>
@@ -45,6 +48,10 @@ private:
   /// Return true if two calls traverse the same tree from the same node
   bool areCompatibleCalls(clang::CallExpr *Call1, clang::CallExpr *Call2);
 
+  /// Return true if a call that has no fusion partner is still worth a
+  /// synthesized traversal, because its subtree visits can run in parallel
+  bool isParallelizableSingleCall(clang::CallExpr *Call);
+
 public:
   /// Search the source code for valid fusion candidates
   void findCandidates() { this->TraverseDecl(Ctx->getTranslationUnitDecl()); }
@@ -80,8 +87,17 @@ public:
                      /*just needed for top level*/,
                      std::string Heuristic);
 
+  /// Rewrite the loops of batched traversal calls found by Batches
+  void performBatching(BatchSynthesizer &Batches) {
+    Batches.synthesize(Rewriter);
+  }
+
   /// Commiting source code updates to the source files
-  void overwriteChangedFiles() { Rewriter.overwriteChangedFiles(); }
+  void overwriteChangedFiles() {
+    TreeLayoutSynthesizer(Ctx, Rewriter).synthesize();
+    RuntimeSupport::emitPreludes(Rewriter);
+    Rewriter.overwriteChangedFiles();
+  }
 
   void performGreedyFusion(DependenceGraph *DepGraph);
 
@@ -94,7 +110,8 @@ public:
 
   // The algorithm for topologically sorting the dependence graph for
   // parallelism
-  vector<vector<DG_Node *>> parallelSchedule(DependenceGraph *DepGraph);
+  static vector<vector<DG_Node *>>
+  parallelSchedule(DependenceGraph *DepGraph);
 
   bool unfusableCallsExist(DG_Node *function1, DG_Node *function2,
                            DependenceGraph *DepGraph);
@@ -42,6 +42,9 @@ extern bool hasFuseAnnotation(clang::FunctionDecl *FunDecl);
 extern bool hasTreeAnnotation(const clang::CXXRecordDecl *RecordDecl);
 extern bool hasChildAnnotation(clang::FieldDecl *FieldDecl);
 extern bool hasStrictAccessAnnotation(clang::Decl *Decl);
+extern bool hasHeavyAnnotation(clang::Decl *Decl);
+extern bool hasBatchAnnotation(const clang::FunctionDecl *FunDecl);
+extern StringRef getShortCircuitField(const clang::Decl *Decl);
 extern std::vector<StrictAccessInfo> getStrictAccessInfo(clang::Decl *Decl);
 
 #endif
@@ -0,0 +1,99 @@
+//===--- PhaseTimer.cpp ---------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "PhaseTimer.h"
+#include "Logger.h"
+#include <chrono>
+#include <fstream>
+#include <sys/resource.h>
+
+extern llvm::cl::OptionCategory TreeFuserCategory;
+namespace opts {
+llvm::cl::opt<std::string> PhaseTimes(
+    "phase-times",
+    cl::desc("write to the given file the number of calls, the wall time and "
+             "the growth of the peak memory of each phase of orchard, as "
+             "comma separated values"),
+    cl::init(""), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+std::vector<std::string> PhaseTimer::Order = std::vector<std::string>();
+
+std::map<std::string, PhaseTimer::PhaseInfo> PhaseTimer::Phases =
+    std::map<std::string, PhaseTimer::PhaseInfo>();
+
+static double ProcessStart = std::chrono::duration<double>(
+                                 std::chrono::steady_clock::now()
+                                     .time_since_epoch())
+                                 .count();
+
+double PhaseTimer::now() {
+  return std::chrono::duration<double>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+long PhaseTimer::peakMemory() {
+  struct rusage Usage;
+  getrusage(RUSAGE_SELF, &Usage);
+#ifdef __APPLE__
+  return Usage.ru_maxrss / 1024;
+#else
+  return Usage.ru_maxrss;
+#endif
+}
+
+PhaseTimer::Scope::Scope(const char *Name) : Name(Name), Active(false) {
+  if (opts::PhaseTimes.empty())
+    return;
+
+  auto &Info = Phases[Name];
+  if (Info.Running++)
+    return;
+  if (Info.Calls == 0)
+    Order.push_back(Name);
+  Active = true;
+  StartPeak = peakMemory();
+  Start = now();
+}
+
+PhaseTimer::Scope::~Scope() {
+  if (opts::PhaseTimes.empty())
+    return;
+
+  auto &Info = Phases[Name];
+  Info.Running--;
+  if (!Active)
+    return;
+  Info.Calls++;
+  Info.Seconds += now() - Start;
+  Info.PeakGrowth += peakMemory() - StartPeak;
+}
+
+void PhaseTimer::writeReport() {
+  if (opts::PhaseTimes.empty())
+    return;
+
+  std::ofstream Output(opts::PhaseTimes);
+  if (!Output.is_open()) {
+    Logger::getStaticLogger().logWarn("could not open the phase times file " +
+                                      opts::PhaseTimes);
+    return;
+  }
+
+  Output << "phase,calls,seconds,peak_rss_growth_kb\n";
+  for (auto &Name : Order) {
+    auto &Info = Phases[Name];
+    Output << Name << "," << Info.Calls << "," << Info.Seconds << ","
+           << Info.PeakGrowth << "\n";
+  }
+  // the whole run, with the peak memory of the process
+  Output << "total,1," << now() - ProcessStart << "," << peakMemory() << "\n";
+}
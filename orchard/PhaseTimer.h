@@ -0,0 +1,65 @@
+//===--- PhaseTimer.h -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Measures the time and the memory spent by orchard in each of its phases, so
+// that the cost of the analysis can be compared across revisions.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_PHASE_TIMER
+#define TREE_FUSER_PHASE_TIMER
+
+#include "LLVMDependencies.h"
+#include <map>
+#include <string>
+#include <vector>
+
+class PhaseTimer {
+public:
+  /// Accounts the lifetime of the object as one call of the phase Name, when
+  /// -phase-times is given. A phase entered again while it is running, by
+  /// recursion, is accounted once.
+  class Scope {
+  public:
+    Scope(const char *Name);
+    ~Scope();
+
+  private:
+    const char *Name;
+    bool Active;
+    double Start;
+    long StartPeak;
+  };
+
+  /// Write the measured phases to the file given by -phase-times, if any
+  static void writeReport();
+
+private:
+  struct PhaseInfo {
+    /// Number of outermost calls of the phase
+    unsigned Calls = 0;
+    /// Wall time in seconds, including the nested phases
+    double Seconds = 0;
+    /// Growth of the peak resident set size during the phase, in kilobytes
+    long PeakGrowth = 0;
+    /// Number of calls of the phase currently running
+    unsigned Running = 0;
+  };
+
+  /// Phases in the order they were first entered
+  static std::vector<std::string> Order;
+
+  static std::map<std::string, PhaseInfo> Phases;
+
+  /// Return the wall clock in seconds
+  static double now();
+
+  /// Return the peak resident set size of the process in kilobytes
+  static long peakMemory();
+};
+
+#endif
@@ -0,0 +1,927 @@
+//===--- RuntimeSupport.cpp -----------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "RuntimeSupport.h"
+
+std::map<clang::FileID, unsigned> RuntimeSupport::RequestedFeatures =
+    std::map<clang::FileID, unsigned>();
+
+// Shared by all the helpers below.
+static const char *CommonPrelude = R"(
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+)";
+
+// Each multiversioned call site owns an _orchard_mv_site. Every version that
+// is allowed for the current invocation is timed once, after that the fastest
+// one (by an exponential moving average of its run time) is used and the
+// others are re-probed periodically so that the choice follows changes in the
+// tree. Parallel code is skipped when a single worker is available or when the
+// size hint says that the tree is small. ORCHARD_VERSION=original|serial|
+// parallel forces a version and ORCHARD_PARALLEL_MIN_SIZE overrides the size
+// threshold. The statistics of a site are guarded by its own mutex, since
+// the site can be reached from several threads at once.
+static const char *MultiversioningPrelude = R"(
+#include <mutex>
+#if defined(__cilk) && defined(__has_include)
+#if __has_include(<cilk/cilk_api.h>)
+#include <cilk/cilk_api.h>
+#define _ORCHARD_NUM_WORKERS() __cilkrts_get_nworkers()
+#endif
+#endif
+#ifndef _ORCHARD_NUM_WORKERS
+#include <thread>
+#define _ORCHARD_NUM_WORKERS() ((int)std::thread::hardware_concurrency())
+#endif
+
+enum { _ORCHARD_ORIGINAL = 0, _ORCHARD_SERIAL = 1, _ORCHARD_PARALLEL = 2 };
+
+/// Number of nodes of the traversed trees as known by the program, 0 if
+/// unknown
+static long _orchard_size_hint = 0;
+static inline void _orchard_set_size_hint(long Size) {
+  _orchard_size_hint = Size;
+}
+
+struct _orchard_mv_site {
+  std::mutex Lock;
+  unsigned long Invocations = 0;
+  unsigned long Samples[3] = {0, 0, 0};
+  double AverageNanos[3] = {0, 0, 0};
+};
+
+static inline int _orchard_mv_forced_version() {
+  static int Forced = [] {
+    const char *Version = std::getenv("ORCHARD_VERSION");
+    if (!Version)
+      return -1;
+    if (!std::strcmp(Version, "original"))
+      return (int)_ORCHARD_ORIGINAL;
+    if (!std::strcmp(Version, "serial"))
+      return (int)_ORCHARD_SERIAL;
+    if (!std::strcmp(Version, "parallel"))
+      return (int)_ORCHARD_PARALLEL;
+    return -1;
+  }();
+  return Forced;
+}
+
+static inline bool _orchard_mv_parallel_allowed() {
+  static long MinSize = [] {
+    const char *Size = std::getenv("ORCHARD_PARALLEL_MIN_SIZE");
+    return Size ? std::atol(Size) : 4096L;
+  }();
+  static int Workers = _ORCHARD_NUM_WORKERS();
+  return Workers > 1 &&
+         (_orchard_size_hint == 0 || _orchard_size_hint >= MinSize);
+}
+
+static inline int _orchard_mv_select(_orchard_mv_site &Site) {
+  int Forced = _orchard_mv_forced_version();
+  if (Forced >= 0)
+    return Forced;
+
+  int VersionsCount = _orchard_mv_parallel_allowed() ? 3 : 2;
+  std::lock_guard<std::mutex> Guard(Site.Lock);
+  unsigned long Invocation = Site.Invocations++;
+
+  for (int Version = 0; Version < VersionsCount; Version++)
+    if (Site.Samples[Version] == 0)
+      return Version;
+
+  int Best = 0;
+  for (int Version = 1; Version < VersionsCount; Version++)
+    if (Site.AverageNanos[Version] < Site.AverageNanos[Best])
+      Best = Version;
+
+  // re-probe one of the other versions every 32 invocations
+  if (Invocation % 32 == 31)
+    return (Best + 1 + (Invocation / 32) % (VersionsCount - 1)) %
+           VersionsCount;
+  return Best;
+}
+
+static inline void
+_orchard_mv_record(_orchard_mv_site &Site, int Version,
+                   std::chrono::steady_clock::time_point Start) {
+  double Nanos = std::chrono::duration<double, std::nano>(
+                     std::chrono::steady_clock::now() - Start)
+                     .count();
+  std::lock_guard<std::mutex> Guard(Site.Lock);
+  if (Site.Samples[Version]++ == 0)
+    Site.AverageNanos[Version] = Nanos;
+  else
+    Site.AverageNanos[Version] = 0.75 * Site.AverageNanos[Version] + 0.25 * Nanos;
+}
+)";
+
+// One flag per short-circuitable traversal, raised by the first worker that
+// finds a result and polled before visiting a node or spawning a call. The
+// flags are reset by the top level call sites.
+static const char *ShortCircuitPrelude = R"(
+#include <atomic>
+
+#define _ORCHARD_MAX_SHORT_CIRCUIT 64
+static std::atomic<bool> _orchard_short_circuit_flags[_ORCHARD_MAX_SHORT_CIRCUIT];
+
+static inline bool _orchard_short_circuited(int Slot) {
+  return _orchard_short_circuit_flags[Slot].load(std::memory_order_relaxed);
+}
+
+static inline void _orchard_short_circuit(int Slot) {
+  _orchard_short_circuit_flags[Slot].store(true, std::memory_order_relaxed);
+}
+
+static inline void _orchard_short_circuit_reset(int Slot) {
+  _orchard_short_circuit_flags[Slot].store(false, std::memory_order_relaxed);
+}
+)";
+
+// Level synchronous execution of the fused traversals. Visiting a node pushes
+// its children, with their arguments, to a buffer of the running worker
+// instead of calling them. Each level is gathered from the buffers, visited
+// with a parallel loop and recorded, then the recorded levels are walked
+// backwards to run the statements that follow the calls. The buffers and the
+// levels are global and keep their storage from one run to the next, so only
+// one run may be in flight at a time: a run that starts while another one is
+// running, nested in a visit or on another thread, aborts the program.
+static const char *FrontierPrelude = R"(
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#if defined(__cilk) && defined(__has_include)
+#if __has_include(<cilk/cilk.h>)
+#include <cilk/cilk.h>
+#define _ORCHARD_PARALLEL_FOR cilk_for
+#endif
+#endif
+#ifndef _ORCHARD_PARALLEL_FOR
+#define _ORCHARD_PARALLEL_FOR for
+#endif
+
+#define _ORCHARD_FRONTIER_CHUNK (1 << 16)
+
+struct _orchard_frontier_item {
+  void (*Visit)(void *);
+  void (*Finish)(void *);
+  void *Args;
+};
+
+struct _orchard_frontier_buffer {
+  std::vector<_orchard_frontier_item> Items;
+  std::vector<std::unique_ptr<unsigned char[]>> Chunks;
+  /// Chunks [0, Current) hold arguments, the last one up to Used bytes
+  size_t Current = 0;
+  size_t Used = 0;
+
+  void *allocate(size_t Size) {
+    Size = (Size + 15) & ~(size_t)15;
+    if (Current == 0 || Used + Size > _ORCHARD_FRONTIER_CHUNK) {
+      if (Current == Chunks.size())
+        Chunks.emplace_back(new unsigned char[_ORCHARD_FRONTIER_CHUNK]);
+      Current++;
+      Used = 0;
+    }
+    void *Memory = Chunks[Current - 1].get() + Used;
+    Used += Size;
+    return Memory;
+  }
+
+  void reset() {
+    Items.clear();
+    Current = 0;
+    Used = 0;
+  }
+};
+
+static std::mutex _orchard_frontier_lock;
+static std::vector<_orchard_frontier_buffer *> _orchard_frontier_buffers;
+static std::vector<std::vector<_orchard_frontier_item>> _orchard_frontier_levels;
+static std::atomic<bool> _orchard_frontier_running(false);
+
+static inline _orchard_frontier_buffer &_orchard_frontier_local() {
+  thread_local _orchard_frontier_buffer *Buffer = nullptr;
+  if (!Buffer) {
+    Buffer = new _orchard_frontier_buffer();
+    std::lock_guard<std::mutex> Guard(_orchard_frontier_lock);
+    _orchard_frontier_buffers.push_back(Buffer);
+  }
+  return *Buffer;
+}
+
+template <typename ArgsType>
+static inline void _orchard_frontier_push(void (*Visit)(void *),
+                                          void (*Finish)(void *),
+                                          const ArgsType &Args) {
+  static_assert(sizeof(ArgsType) <= _ORCHARD_FRONTIER_CHUNK,
+                "traversal arguments do not fit in a frontier chunk");
+  auto &Buffer = _orchard_frontier_local();
+  void *Copy = new (Buffer.allocate(sizeof(ArgsType))) ArgsType(Args);
+  Buffer.Items.push_back(_orchard_frontier_item{Visit, Finish, Copy});
+}
+
+template <typename SeedType> static void _orchard_frontier_run(SeedType Seed) {
+  if (_orchard_frontier_running.exchange(true)) {
+    std::fprintf(stderr, "orchard: frontier runs are not reentrant\n");
+    std::abort();
+  }
+  for (auto *Buffer : _orchard_frontier_buffers)
+    Buffer->reset();
+  Seed();
+
+  size_t Depth = 0;
+  while (true) {
+    if (_orchard_frontier_levels.size() == Depth)
+      _orchard_frontier_levels.emplace_back();
+    auto &Level = _orchard_frontier_levels[Depth];
+    Level.clear();
+    for (auto *Buffer : _orchard_frontier_buffers) {
+      Level.insert(Level.end(), Buffer->Items.begin(), Buffer->Items.end());
+      Buffer->Items.clear();
+    }
+    if (Level.empty())
+      break;
+    _ORCHARD_PARALLEL_FOR (long i = 0; i < (long)Level.size(); i++)
+      Level[i].Visit(Level[i].Args);
+    Depth++;
+  }
+
+  while (Depth-- > 0) {
+    auto &Level = _orchard_frontier_levels[Depth];
+    _ORCHARD_PARALLEL_FOR (long i = 0; i < (long)Level.size(); i++)
+      if (Level[i].Finish)
+        Level[i].Finish(Level[i].Args);
+  }
+  _orchard_frontier_running = false;
+}
+)";
+
+// The nodes of a relaid tree share one arena, each of them starts at an
+// offset that is suitably aligned for any type.
+static const char *RelayoutPrelude = R"(
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#define _ORCHARD_RELAYOUT_SIZE(Type)                                           \
+  ((sizeof(Type) + alignof(std::max_align_t) - 1) &                            \
+   ~(alignof(std::max_align_t) - 1))
+)";
+
+// Nodes of up to _ORCHARD_POOL_CLASSES granules are served by the free list
+// of their size class, then carved from the arena of the running worker, and
+// larger ones by the global allocator. A freed node goes to the free list of
+// the worker that frees it. The arenas are 2MB aligned to be backed by huge
+// pages, explicitly if some are reserved (MAP_HUGETLB) and otherwise
+// transparently. _orchard_pool_release() frees all the nodes of all the pools
+// at once, without running their destructors.
+static const char *PoolAllocatorPrelude = R"(
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#define _ORCHARD_POOL_GRANULE 16
+#define _ORCHARD_POOL_CLASSES 32
+#define _ORCHARD_POOL_ARENA ((std::size_t)2 << 20)
+
+struct _orchard_pool {
+  void *Free[_ORCHARD_POOL_CLASSES] = {};
+  unsigned char *Current = nullptr;
+  std::size_t Left = 0;
+  unsigned long Generation = 0;
+};
+
+static std::mutex _orchard_pool_lock;
+static std::vector<void *> _orchard_pool_arenas;
+static std::atomic<unsigned long> _orchard_pool_generation(0);
+
+static inline void *_orchard_pool_map_arena() {
+#if defined(__linux__)
+#ifdef MAP_HUGETLB
+  void *Arena = mmap(nullptr, _ORCHARD_POOL_ARENA, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (Arena != MAP_FAILED)
+    return Arena;
+#endif
+  // map twice the size and trim it to an aligned arena
+  void *Mapping = mmap(nullptr, 2 * _ORCHARD_POOL_ARENA, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (Mapping == MAP_FAILED)
+    throw std::bad_alloc();
+  std::uintptr_t Begin = (std::uintptr_t)Mapping;
+  std::uintptr_t Aligned =
+      (Begin + _ORCHARD_POOL_ARENA - 1) & ~(std::uintptr_t)(_ORCHARD_POOL_ARENA - 1);
+  if (Aligned != Begin)
+    munmap(Mapping, Aligned - Begin);
+  if (Aligned + _ORCHARD_POOL_ARENA != Begin + 2 * _ORCHARD_POOL_ARENA)
+    munmap((void *)(Aligned + _ORCHARD_POOL_ARENA),
+           Begin + _ORCHARD_POOL_ARENA - Aligned);
+#ifdef MADV_HUGEPAGE
+  madvise((void *)Aligned, _ORCHARD_POOL_ARENA, MADV_HUGEPAGE);
+#endif
+  return (void *)Aligned;
+#else
+  void *Arena = std::malloc(_ORCHARD_POOL_ARENA);
+  if (!Arena)
+    throw std::bad_alloc();
+  return Arena;
+#endif
+}
+
+static inline _orchard_pool &_orchard_pool_local() {
+  thread_local _orchard_pool Pool;
+  unsigned long Generation =
+      _orchard_pool_generation.load(std::memory_order_acquire);
+  if (Pool.Generation != Generation) {
+    Pool = _orchard_pool();
+    Pool.Generation = Generation;
+  }
+  return Pool;
+}
+
+static inline void *_orchard_pool_allocate(std::size_t Size) {
+  std::size_t Class = Size ? (Size - 1) / _ORCHARD_POOL_GRANULE : 0;
+  if (Class >= _ORCHARD_POOL_CLASSES)
+    return ::operator new(Size);
+
+  auto &Pool = _orchard_pool_local();
+  if (void *Node = Pool.Free[Class]) {
+    Pool.Free[Class] = *(void **)Node;
+    return Node;
+  }
+
+  std::size_t Bytes = (Class + 1) * _ORCHARD_POOL_GRANULE;
+  if (Pool.Left < Bytes) {
+    void *Arena = _orchard_pool_map_arena();
+    {
+      std::lock_guard<std::mutex> Guard(_orchard_pool_lock);
+      _orchard_pool_arenas.push_back(Arena);
+    }
+    Pool.Current = (unsigned char *)Arena;
+    Pool.Left = _ORCHARD_POOL_ARENA;
+  }
+  void *Node = Pool.Current;
+  Pool.Current += Bytes;
+  Pool.Left -= Bytes;
+  return Node;
+}
+
+static inline void _orchard_pool_free(void *Node, std::size_t Size) {
+  if (!Node)
+    return;
+  std::size_t Class = Size ? (Size - 1) / _ORCHARD_POOL_GRANULE : 0;
+  if (Class >= _ORCHARD_POOL_CLASSES) {
+    ::operator delete(Node);
+    return;
+  }
+  auto &Pool = _orchard_pool_local();
+  *(void **)Node = Pool.Free[Class];
+  Pool.Free[Class] = Node;
+}
+
+/// Free all the nodes allocated from the pools, no node of a tree class may
+/// be used or deleted afterwards. Must not run concurrently with allocations
+static inline void _orchard_pool_release() {
+  std::lock_guard<std::mutex> Guard(_orchard_pool_lock);
+  for (void *Arena : _orchard_pool_arenas)
+#if defined(__linux__)
+    munmap(Arena, _ORCHARD_POOL_ARENA);
+#else
+    std::free(Arena);
+#endif
+  _orchard_pool_arenas.clear();
+  _orchard_pool_generation.fetch_add(1, std::memory_order_release);
+}
+)";
+
+// Every worker counts in its own cache line aligned block, the blocks are
+// summed when the program exits and the counts are printed to stderr per
+// synthesized function and per node type. Counting a visit is a thread local
+// increment. Each worker measures the cycles of its outermost running call of
+// each synthesized function, including the calls that it makes, so the
+// recursive calls are not measured again. A call that continues on another
+// worker after a steal updates the depth of the worker where it started.
+static const char *VisitCountersPrelude = R"(
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define _ORCHARD_CYCLES() ((unsigned long long)__rdtsc())
+#else
+#define _ORCHARD_CYCLES()                                                      \
+  ((unsigned long long)std::chrono::steady_clock::now()                        \
+       .time_since_epoch()                                                     \
+       .count())
+#endif
+
+#define _ORCHARD_MAX_COUNTER_SITES 1024
+
+struct alignas(64) _orchard_counter_block {
+  unsigned long long Visits[_ORCHARD_MAX_COUNTER_SITES] = {};
+  unsigned long long Cycles[_ORCHARD_MAX_COUNTER_SITES] = {};
+  /// Number of running calls of each site started by this worker
+  std::atomic<unsigned> Depth[_ORCHARD_MAX_COUNTER_SITES] = {};
+};
+
+struct _orchard_counter_registry {
+  std::mutex Lock;
+  /// Synthesized function and node type of each site
+  std::vector<std::pair<std::string, std::string>> Sites;
+  std::vector<_orchard_counter_block *> Blocks;
+
+  ~_orchard_counter_registry() {
+    if (Sites.empty())
+      return;
+    std::map<std::string, unsigned long long> TypeVisits;
+    unsigned long long Total = 0;
+    std::fprintf(stderr, "orchard counters:\n");
+    for (size_t Site = 0; Site < Sites.size(); Site++) {
+      unsigned long long Visits = 0, Cycles = 0;
+      for (auto *Block : Blocks) {
+        Visits += Block->Visits[Site];
+        Cycles += Block->Cycles[Site];
+      }
+      TypeVisits[Sites[Site].second] += Visits;
+      Total += Visits;
+      std::fprintf(stderr, "  %s (%s): %llu visits, %llu cycles\n",
+                   Sites[Site].first.c_str(), Sites[Site].second.c_str(),
+                   Visits, Cycles);
+    }
+    for (auto &Entry : TypeVisits)
+      std::fprintf(stderr, "  %s: %llu visits\n", Entry.first.c_str(),
+                   Entry.second);
+    std::fprintf(stderr, "  total: %llu visits\n", Total);
+  }
+};
+
+static _orchard_counter_registry _orchard_counters;
+
+/// Return the site of a synthesized function and node type, or -1 when all
+/// the sites are taken
+static inline int _orchard_counter_site(const char *Function,
+                                        const char *Type) {
+  std::lock_guard<std::mutex> Guard(_orchard_counters.Lock);
+  auto Key = std::make_pair(std::string(Function), std::string(Type));
+  for (size_t Site = 0; Site < _orchard_counters.Sites.size(); Site++)
+    if (_orchard_counters.Sites[Site] == Key)
+      return Site;
+  if (_orchard_counters.Sites.size() == _ORCHARD_MAX_COUNTER_SITES)
+    return -1;
+  _orchard_counters.Sites.push_back(Key);
+  return _orchard_counters.Sites.size() - 1;
+}
+
+static inline _orchard_counter_block &_orchard_counter_local() {
+  thread_local _orchard_counter_block *Block = nullptr;
+  if (!Block) {
+    // the blocks outlive the threads, they are read at exit
+    void *Memory = std::malloc(sizeof(_orchard_counter_block) + 64);
+    if (!Memory)
+      throw std::bad_alloc();
+    Block = new ((void *)(((std::uintptr_t)Memory + 63) &
+                          ~(std::uintptr_t)63)) _orchard_counter_block();
+    std::lock_guard<std::mutex> Guard(_orchard_counters.Lock);
+    _orchard_counters.Blocks.push_back(Block);
+  }
+  return *Block;
+}
+
+static inline void _orchard_count_visit(int Site) {
+  if (Site >= 0)
+    _orchard_counter_local().Visits[Site]++;
+}
+
+struct _orchard_cycle_scope {
+  int Site;
+  std::atomic<unsigned> *Depth;
+  bool Outermost;
+  unsigned long long Start;
+  _orchard_cycle_scope(int Site_)
+      : Site(Site_),
+        Depth(Site >= 0 ? &_orchard_counter_local().Depth[Site] : nullptr),
+        Outermost(Depth &&
+                  Depth->fetch_add(1, std::memory_order_relaxed) == 0),
+        Start(Outermost ? _ORCHARD_CYCLES() : 0) {}
+  ~_orchard_cycle_scope() {
+    if (Outermost)
+      _orchard_counter_local().Cycles[Site] += _ORCHARD_CYCLES() - Start;
+    if (Depth)
+      Depth->fetch_sub(1, std::memory_order_relaxed);
+  }
+};
+)";
+
+// With ORCHARD_WORK_SPAN defined, spawns become plain calls and the program
+// runs serially. Every parallel visit and every spawned call keeps a frame
+// with the span of its continuation since the last sync and the longest path
+// through the calls spawned since then. A frame adds its span to its parent
+// when it returns, as a parallel path if it was spawned and in sequence
+// otherwise. The iterations of a parallel loop are spawned frames, synced
+// after the loop. The work of a top level call is its serial run time, the
+// parallelism of its call site is the total work over the total span.
+// Without ORCHARD_WORK_SPAN the macros expand to the Cilk keywords.
+static const char *WorkSpanPrelude = R"(
+#ifdef ORCHARD_WORK_SPAN
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+static inline long long _orchard_ws_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct _orchard_ws_frame;
+static inline _orchard_ws_frame *&_orchard_ws_current() {
+  thread_local _orchard_ws_frame *Current = nullptr;
+  return Current;
+}
+
+struct _orchard_ws_frame {
+  _orchard_ws_frame *Parent;
+  bool Spawned;
+  bool Finished = false;
+  long long Continuation = 0;
+  long long ChildrenSpan = 0;
+  long long StrandStart;
+  long long Span = 0;
+
+  _orchard_ws_frame(bool Spawned_)
+      : Parent(_orchard_ws_current()), Spawned(Spawned_) {
+    StrandStart = _orchard_ws_now();
+    if (Parent)
+      Parent->Continuation += StrandStart - Parent->StrandStart;
+    _orchard_ws_current() = this;
+  }
+
+  void sync() {
+    long long Now = _orchard_ws_now();
+    Continuation =
+        std::max(Continuation + Now - StrandStart, ChildrenSpan);
+    ChildrenSpan = 0;
+    StrandStart = Now;
+  }
+
+  long long finish() {
+    if (!Finished) {
+      sync();
+      Span = Continuation;
+      Finished = true;
+    }
+    return Span;
+  }
+
+  ~_orchard_ws_frame() {
+    finish();
+    _orchard_ws_current() = Parent;
+    if (!Parent)
+      return;
+    if (Spawned)
+      Parent->ChildrenSpan =
+          std::max(Parent->ChildrenSpan, Parent->Continuation + Span);
+    else
+      Parent->Continuation += Span;
+    Parent->StrandStart = _orchard_ws_now();
+  }
+};
+
+static inline void _orchard_ws_sync() {
+  if (_orchard_ws_current())
+    _orchard_ws_current()->sync();
+}
+
+struct _orchard_ws_site {
+  const char *Name;
+  unsigned long Calls = 0;
+  long long Work = 0;
+  long long Span = 0;
+};
+
+struct _orchard_ws_report {
+  std::vector<_orchard_ws_site *> Sites;
+  ~_orchard_ws_report() {
+    if (Sites.empty())
+      return;
+    std::fprintf(stderr, "orchard work/span:\n");
+    for (auto *Site : Sites)
+      std::fprintf(stderr,
+                   "  %s: %lu calls, work %.3f ms, span %.3f ms, "
+                   "parallelism %.2f\n",
+                   Site->Name, Site->Calls, Site->Work / 1e6, Site->Span / 1e6,
+                   Site->Span ? (double)Site->Work / Site->Span : 0.0);
+  }
+};
+
+static _orchard_ws_report _orchard_ws_sites;
+
+/// The sites outlive the report, they are never freed
+static inline _orchard_ws_site &_orchard_ws_register(const char *Name) {
+  auto *Site = new _orchard_ws_site();
+  Site->Name = Name;
+  _orchard_ws_sites.Sites.push_back(Site);
+  return *Site;
+}
+
+struct _orchard_ws_root : _orchard_ws_frame {
+  _orchard_ws_site &Site;
+  long long Start;
+  _orchard_ws_root(_orchard_ws_site &Site_)
+      : _orchard_ws_frame(false), Site(Site_), Start(_orchard_ws_now()) {}
+  ~_orchard_ws_root() {
+    long long Work = _orchard_ws_now() - Start;
+    Site.Calls++;
+    Site.Work += Work;
+    Site.Span += finish();
+  }
+};
+
+#define _ORCHARD_SPAWN _orchard_ws_frame(true),
+#define _ORCHARD_SYNC _orchard_ws_sync()
+#define _ORCHARD_FOR for
+#define _ORCHARD_FOR_ITERATION _orchard_ws_frame _orchard_ws_iteration(true);
+#define _ORCHARD_FOR_END _orchard_ws_sync();
+#define _ORCHARD_WS_FRAME _orchard_ws_frame _orchard_ws_self(false);
+#define _ORCHARD_WS_ROOT(Name)                                                 \
+  static _orchard_ws_site &_orchard_ws_stats = _orchard_ws_register(Name);     \
+  _orchard_ws_root _orchard_ws_root_frame(_orchard_ws_stats);
+#else
+#define _ORCHARD_SPAWN cilk_spawn
+#define _ORCHARD_SYNC cilk_sync
+#define _ORCHARD_FOR cilk_for
+#define _ORCHARD_FOR_ITERATION
+#define _ORCHARD_FOR_END
+#define _ORCHARD_WS_FRAME
+#define _ORCHARD_WS_ROOT(Name)
+#endif
+)";
+
+// With ORCHARD_TRACE defined, each worker appends the recorded invocations
+// and syncs to its own chunked buffer, without locking, and the buffers are
+// written at exit to ORCHARD_TRACE_FILE (orchard_trace.json by default) in
+// the Chrome trace event format, with one row per worker. A worker records up
+// to ORCHARD_TRACE_MAX_EVENTS events (1M by default) and drops the others.
+static const char *TracePrelude = R"(
+#ifdef ORCHARD_TRACE
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define _ORCHARD_TRACE_CHUNK 4096
+
+struct _orchard_trace_event {
+  const char *Name;
+  long long Begin;
+  long long End;
+  unsigned int Flags;
+};
+
+struct _orchard_trace_buffer {
+  std::vector<std::unique_ptr<_orchard_trace_event[]>> Chunks;
+  size_t Count = 0;
+  size_t Dropped = 0;
+  int Worker;
+};
+
+static inline long long _orchard_trace_now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct _orchard_trace_writer {
+  std::mutex Lock;
+  std::vector<_orchard_trace_buffer *> Buffers;
+
+  ~_orchard_trace_writer() {
+    if (Buffers.empty())
+      return;
+    const char *Path = std::getenv("ORCHARD_TRACE_FILE");
+    std::FILE *File = std::fopen(Path ? Path : "orchard_trace.json", "w");
+    if (!File)
+      return;
+    std::fprintf(File, "{\"traceEvents\":[\n");
+    bool First = true;
+    for (auto *Buffer : Buffers) {
+      for (size_t I = 0; I < Buffer->Count; I++) {
+        auto &Event =
+            Buffer->Chunks[I / _ORCHARD_TRACE_CHUNK][I % _ORCHARD_TRACE_CHUNK];
+        std::fprintf(File,
+                     "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,"
+                     "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"truncate_flags\":"
+                     "%u}}",
+                     First ? "" : ",\n", Event.Name, Buffer->Worker,
+                     Event.Begin / 1e3, (Event.End - Event.Begin) / 1e3,
+                     Event.Flags);
+        First = false;
+      }
+      if (Buffer->Dropped)
+        std::fprintf(stderr, "orchard trace: worker %d dropped %zu events\n",
+                     Buffer->Worker, Buffer->Dropped);
+    }
+    std::fprintf(File, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    std::fclose(File);
+  }
+};
+
+static _orchard_trace_writer _orchard_trace_buffers;
+
+static inline _orchard_trace_buffer &_orchard_trace_local() {
+  thread_local _orchard_trace_buffer *Buffer = nullptr;
+  if (!Buffer) {
+    // the buffers outlive the workers, they are written at exit
+    Buffer = new _orchard_trace_buffer();
+    std::lock_guard<std::mutex> Guard(_orchard_trace_buffers.Lock);
+    Buffer->Worker = _orchard_trace_buffers.Buffers.size();
+    _orchard_trace_buffers.Buffers.push_back(Buffer);
+  }
+  return *Buffer;
+}
+
+static inline void _orchard_trace_record(const char *Name, long long Begin,
+                                         unsigned int Flags) {
+  static size_t MaxEvents = [] {
+    const char *Max = std::getenv("ORCHARD_TRACE_MAX_EVENTS");
+    return Max ? (size_t)std::atol(Max) : (size_t)1 << 20;
+  }();
+  long long End = _orchard_trace_now();
+  auto &Buffer = _orchard_trace_local();
+  if (Buffer.Count == MaxEvents) {
+    Buffer.Dropped++;
+    return;
+  }
+  if (Buffer.Count == Buffer.Chunks.size() * _ORCHARD_TRACE_CHUNK)
+    Buffer.Chunks.emplace_back(new _orchard_trace_event[_ORCHARD_TRACE_CHUNK]);
+  Buffer.Chunks[Buffer.Count / _ORCHARD_TRACE_CHUNK]
+               [Buffer.Count % _ORCHARD_TRACE_CHUNK] =
+      _orchard_trace_event{Name, Begin, End, Flags};
+  Buffer.Count++;
+}
+
+/// Records the invocation of a traversal, if Name is set, when it returns,
+/// on the worker that finishes it
+struct _orchard_trace_scope {
+  const char *Name;
+  unsigned int Flags;
+  long long Begin;
+  _orchard_trace_scope(const char *Name_, unsigned int Flags_)
+      : Name(Name_), Flags(Flags_),
+        Begin(Name_ ? _orchard_trace_now() : 0) {}
+  ~_orchard_trace_scope() {
+    if (Name)
+      _orchard_trace_record(Name, Begin, Flags);
+  }
+};
+
+#define _ORCHARD_TRACE_VISIT(Name, Flags, Recorded)                            \
+  _orchard_trace_scope _orchard_trace((Recorded) ? Name : nullptr, Flags);
+#define _ORCHARD_TRACE_SYNC_BEGIN                                              \
+  long long _orchard_sync_begin = _orchard_trace.Name ? _orchard_trace_now() : 0;
+#define _ORCHARD_TRACE_SYNC_END                                                \
+  if (_orchard_trace.Name)                                                     \
+    _orchard_trace_record("cilk_sync", _orchard_sync_begin,                   \
+                          _orchard_trace.Flags);
+#else
+#define _ORCHARD_TRACE_VISIT(Name, Flags, Recorded)
+#define _ORCHARD_TRACE_SYNC_BEGIN
+#define _ORCHARD_TRACE_SYNC_END
+#endif
+)";
+
+// A batched traversal visits each node once for all its lanes, the calls
+// that still visit the node. The arguments of the lanes are kept in
+// _orchard_lanes arrays, whose first elements are stored inline since most of
+// the batches near the leaves are small. The children visited by fewer than
+// _ORCHARD_BATCH_SPAWN_MIN lanes are not worth a task.
+static const char *BatchPrelude = R"(
+#include <new>
+#include <utility>
+#if defined(__cilk) && defined(__has_include)
+#if __has_include(<cilk/cilk.h>)
+#include <cilk/cilk.h>
+#define _ORCHARD_BATCH_SPAWN cilk_spawn
+#define _ORCHARD_BATCH_SYNC cilk_sync
+#endif
+#endif
+#ifndef _ORCHARD_BATCH_SPAWN
+#define _ORCHARD_BATCH_SPAWN
+#define _ORCHARD_BATCH_SYNC
+#endif
+#ifndef _ORCHARD_BATCH_SPAWN_MIN
+#define _ORCHARD_BATCH_SPAWN_MIN 8
+#endif
+
+template <typename T> struct _orchard_lanes {
+  static const int Inline = 16;
+  T *Data;
+  int Size = 0;
+  int Capacity = Inline;
+  alignas(T) unsigned char Buffer[Inline * sizeof(T)];
+
+  _orchard_lanes() : Data(reinterpret_cast<T *>(Buffer)) {}
+  _orchard_lanes(int Count, const T &Value) : _orchard_lanes() {
+    for (int i = 0; i < Count; i++)
+      push(Value);
+  }
+  _orchard_lanes(const _orchard_lanes &) = delete;
+  _orchard_lanes &operator=(const _orchard_lanes &) = delete;
+  ~_orchard_lanes() {
+    for (int i = 0; i < Size; i++)
+      Data[i].~T();
+    if (Data != reinterpret_cast<T *>(Buffer))
+      std::free(Data);
+  }
+
+  void push(const T &Value) {
+    if (Size == Capacity) {
+      T *Grown = static_cast<T *>(std::malloc(2 * Capacity * sizeof(T)));
+      for (int i = 0; i < Size; i++) {
+        new (Grown + i) T(std::move(Data[i]));
+        Data[i].~T();
+      }
+      if (Data != reinterpret_cast<T *>(Buffer))
+        std::free(Data);
+      Data = Grown;
+      Capacity *= 2;
+    }
+    new (Data + Size++) T(Value);
+  }
+
+  T &operator[](int Index) { return Data[Index]; }
+  T *data() { return Data; }
+  int size() const { return Size; }
+};
+)";
+
+void RuntimeSupport::require(const clang::SourceManager &SM,
+                             clang::SourceLocation Loc, unsigned Features) {
+  RequestedFeatures[SM.getFileID(SM.getExpansionLoc(Loc))] |= Features;
+}
+
+std::string RuntimeSupport::getPreludeText(unsigned Features) {
+  std::string Prelude = "//added by fuse transformer: runtime support\n";
+  Prelude += CommonPrelude;
+  if (Features & Multiversioning)
+    Prelude += MultiversioningPrelude;
+  if (Features & ShortCircuit)
+    Prelude += ShortCircuitPrelude;
+  if (Features & ExplicitStack)
+    Prelude += "#include <vector>\n";
+  if (Features & SpineChunking)
+    Prelude += "#include <typeinfo>\n#include <vector>\n";
+  if (Features & Frontier)
+    Prelude += FrontierPrelude;
+  if (Features & PoolAllocator)
+    Prelude += PoolAllocatorPrelude;
+  if (Features & Relayout)
+    Prelude += RelayoutPrelude;
+  if (Features & VisitCounters)
+    Prelude += VisitCountersPrelude;
+  if (Features & WorkSpan)
+    Prelude += WorkSpanPrelude;
+  if (Features & Trace)
+    Prelude += TracePrelude;
+  if (Features & Batch)
+    Prelude += BatchPrelude;
+  return Prelude + "\n";
+}
+
+void RuntimeSupport::emitPreludes(clang::Rewriter &Rewriter) {
+  auto &SM = Rewriter.getSourceMgr();
+  for (auto &Entry : RequestedFeatures) {
+    if (!Entry.second)
+      continue;
+    Rewriter.InsertText(SM.getLocForStartOfFile(Entry.first),
+                        getPreludeText(Entry.second));
+  }
+  RequestedFeatures.clear();
+}
@@ -0,0 +1,65 @@
+//===--- RuntimeSupport.h -------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Tracks the runtime helpers that the synthesized code depends on and emits
+// them once at the top of every rewritten file, so that the fused output stays
+// self-contained.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_RUNTIME_SUPPORT
+#define TREE_FUSER_RUNTIME_SUPPORT
+
+#include "LLVMDependencies.h"
+#include <map>
+#include <string>
+
+class RuntimeSupport {
+public:
+  /// Helpers that can be requested by the code generator
+  enum Feature : unsigned {
+    /// Call-site version selection between original, serial and parallel code
+    Multiversioning = 1 << 0,
+    /// Cancellation flags of short-circuitable traversals
+    ShortCircuit = 1 << 1,
+    /// Explicit stacks of the iterative serial traversals
+    ExplicitStack = 1 << 2,
+    /// Gathering of the chains of nodes visited by parallel loops
+    SpineChunking = 1 << 3,
+    /// Per worker frontiers of the level synchronous traversals
+    Frontier = 1 << 4,
+    /// Arena copies of the trees made by the relayout functions
+    Relayout = 1 << 5,
+    /// Per worker pools behind the operator new of the tree classes
+    PoolAllocator = 1 << 6,
+    /// Per worker visit and cycle counters of the synthesized traversals
+    VisitCounters = 1 << 7,
+    /// Work and span accounting of the parallel traversals
+    WorkSpan = 1 << 8,
+    /// Per worker event buffers of the Chrome trace
+    Trace = 1 << 9,
+    /// Lane arrays of the batched traversals
+    Batch = 1 << 10,
+  };
+
+  /// Request the given features for the file that contains Loc
+  static void require(const clang::SourceManager &SM, clang::SourceLocation Loc,
+                      unsigned Features);
+
+  /// Insert the requested helpers at the beginning of each file and reset the
+  /// requests
+  static void emitPreludes(clang::Rewriter &Rewriter);
+
+private:
+  /// Requested features per file
+  static std::map<clang::FileID, unsigned> RequestedFeatures;
+
+  /// Return the helpers source text for the given set of features
+  static std::string getPreludeText(unsigned Features);
+};
+
+#endif
@@ -8,6 +8,7 @@
 //===----------------------------------------------------------------------===//
 //
 //===----------------------------------------------------------------------===//
+#include <PhaseTimer.h>
 #include <StatementInfo.h>
 
 #define DEBUG_TYPE "stmt-info"
@@ -276,6 +277,7 @@ void buildFromCall(
 const FSM &StatementInfo::getExtendedTreeReadsAutomata() {
   assert(isCallStmt());
   if (!ExtendedTreeReadsAutomata) {
+    PhaseTimer::Scope Timer("fsm-call-automata");
     ExtendedTreeReadsAutomata = new FSM();
     ExtendedTreeReadsAutomata->AddState();
     ExtendedTreeReadsAutomata->SetStart(0);
@@ -294,6 +296,7 @@ const FSM &StatementInfo::getExtendedTreeReadsAutomata() {
 const FSM &StatementInfo::getExtendedTreeWritesAutomata() {
   assert(isCallStmt());
   if (!ExtendedTreeWritesAutomata) {
+    PhaseTimer::Scope Timer("fsm-call-automata");
     ExtendedTreeWritesAutomata = new FSM();
     ExtendedTreeWritesAutomata->AddState();
     ExtendedTreeWritesAutomata->SetStart(0);
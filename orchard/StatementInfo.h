@@ -30,6 +30,9 @@ private:
   /// Determine if the statment is a traversing call
   bool IsCallStmt;
 
+  /// Determine if the statement is expensive enough to run as its own task
+  bool IsHeavy = false;
+
   /// The traversed child for call statmetnts
   clang::FieldDecl *CalledChild = nullptr;
 
@@ -105,6 +108,12 @@ public:
   /// Return true if the statement is recursive call
   bool isCallStmt() { return IsCallStmt; }
 
+  /// Return true if the statement is a heavy non-call statement that can be
+  /// scheduled in parallel with calls
+  bool isHeavy() { return IsHeavy; }
+
+  void setHeavy(bool NewValue) { IsHeavy = NewValue; }
+
   /// Return the called child of a call statement
   clang::FieldDecl *getCalledChild() {
     assert(IsCallStmt);
@@ -9,11 +9,14 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "BatchSynthesizer.h"
+#include "FieldLayout.h"
 #include "FunctionAnalyzer.h"
 #include "FunctionsFinder.h"
 #include "FuseTransformation.h"
 #include "LLVMDependencies.h"
 #include "Logger.h"
+#include "PhaseTimer.h"
 #include "RecordAnalyzer.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -45,12 +48,15 @@ int main(int argc, const char **argv) {
                                       OptionsParser.getSourcePathList());
 
   std::vector<std::unique_ptr<ASTUnit>> ASTList;
-  ClangTool.buildASTs(ASTList);
-
-  if (ClangTool.run(
-          newFrontendActionFactory<clang::SyntaxOnlyAction>().get())) {
-    errs() << "ERROR: input source files have a compilation error";
-    return 0;
+  {
+    PhaseTimer::Scope Timer("parse");
+    ClangTool.buildASTs(ASTList);
+
+    if (ClangTool.run(
+            newFrontendActionFactory<clang::SyntaxOnlyAction>().get())) {
+      errs() << "ERROR: input source files have a compilation error";
+      return 0;
+    }
   }
 
   RecordsAnalyzer RecordAnalyserInstance;
@@ -58,23 +64,39 @@ int main(int argc, const char **argv) {
 
   outs() << ("INFO: anlyzing records\n");
 
-  for (auto &ASTUnit : ASTList)
-    RecordAnalyserInstance.analyzeRecordsDeclarations(
-        ASTUnit.get()->getASTContext());
+  {
+    PhaseTimer::Scope Timer("analyzeRecords");
+    for (auto &ASTUnit : ASTList)
+      RecordAnalyserInstance.analyzeRecordsDeclarations(
+          ASTUnit.get()->getASTContext());
+  }
 
   outs() << ("INFO: analyzing functions\n");
 
-  for (auto &ASTUnit : ASTList)
-    FunctionsInfo.findFunctions(ASTUnit.get()->getASTContext());
+  {
+    PhaseTimer::Scope Timer("findFunctions");
+    for (auto &ASTUnit : ASTList)
+      FunctionsInfo.findFunctions(ASTUnit.get()->getASTContext());
+  }
 
   outs() << ("INFO: running transformation\n");
 
   for (auto &ASTUnit : ASTList) {
     auto *Ctx = &ASTUnit.get()->getASTContext();
     FusionCandidatesFinder CandidatesFinder(Ctx, &FunctionsInfo);
+    BatchSynthesizer Batches(Ctx);
+
+    // Find the loops of batchable calls, before the candidates that skip them
+    {
+      PhaseTimer::Scope Timer("findBatches");
+      Batches.findBatches();
+    }
 
     // Find candidates
-    CandidatesFinder.findCandidates();
+    {
+      PhaseTimer::Scope Timer("findCandidates");
+      CandidatesFinder.findCandidates();
+    }
     FusionTransformer Transformer(Ctx, &FunctionsInfo, Heuristic);
 
     // Perform fusion
@@ -82,12 +104,22 @@ int main(int argc, const char **argv) {
       auto *EnclosingFunctionDecl = Entry.first;
       for (auto &Candidate : Entry.second) {
         // Must be defined locally to avoid duplicate functions definitions
+        PhaseTimer::Scope Timer("performFusion");
         Transformer.performFusion(Candidate, true, EnclosingFunctionDecl,
                                   Heuristic);
         // Commit source file changes
       }
     }
-    Transformer.overwriteChangedFiles();
+    {
+      PhaseTimer::Scope Timer("synthesizeBatches");
+      Transformer.performBatching(Batches);
+    }
+    {
+      PhaseTimer::Scope Timer("overwriteChangedFiles");
+      Transformer.overwriteChangedFiles();
+    }
   }
+  FieldLayoutAdvisor::writeRecommendation();
+  PhaseTimer::writeReport();
   return 0;
 }
\ No newline at end of file
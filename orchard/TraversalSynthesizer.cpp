@@ -11,12 +11,147 @@
 //===----------------------------------------------------------------------===//
 
 #include "TraversalSynthesizer.h"
+#include "FieldLayout.h"
+#include "RuntimeSupport.h"
 
 #define FUSE_CAP 2
 #define diff_CAP 4
 using namespace std;
 #include <string>
 
+extern llvm::cl::OptionCategory TreeFuserCategory;
+namespace opts {
+llvm::cl::opt<bool>
+    Multiversion("multiversion",
+                 cl::desc("keep the original calls at top level call sites and "
+                          "select at runtime between them and the serial and "
+                          "parallel fused traversals"),
+                 cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> HoistGuards(
+    "hoist-guards",
+    cl::desc("evaluate the leading early return of the called traversals at "
+             "the call site, and skip the call when no traversal is left"),
+    cl::init(true), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> ClosedHierarchy(
+    "closed-hierarchy",
+    cl::desc("assume that all the classes of the traversed trees are known, "
+             "tag each of them and dispatch virtual traversals with a switch "
+             "over the tag instead of virtual stubs"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> ElideLeafCalls(
+    "elide-leaf-calls",
+    cl::desc("drop the calls that are empty for every possible type of the "
+             "child and call leaves serially, with -closed-hierarchy decide "
+             "per type at the call site"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> UnrollDepth(
+    "unroll-depth",
+    cl::desc("number of levels of recursive child calls to inline into the "
+             "synthesized serial traversals (0 disables unrolling)"),
+    cl::init(0), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> UnrollMaxSize(
+    "unroll-max-size",
+    cl::desc("maximum number of statements of a synthesized serial traversal "
+             "that is inlined by -unroll-depth"),
+    cl::init(40), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> IterativeSerial(
+    "iterative-serial",
+    cl::desc("generate self recursive synthesized serial traversals as loops "
+             "over an explicit heap allocated stack"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> FrontierMode(
+    "frontier",
+    cl::desc("run the fused traversals of top level call sites level by level "
+             "over a frontier of nodes with parallel loops, when the calls of "
+             "each visited node are independent of each other"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> PipelineUnfused(
+    "pipeline-unfused",
+    cl::desc("run the calls of traversals that could not be fused together as "
+             "one chain of calls per visited child, so that a traversal "
+             "starts on a subtree as soon as the traversals it depends on are "
+             "done with that subtree"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> ChunkSpines(
+    "chunk-spines",
+    cl::desc("gather list shaped chains of nodes of the same type into an "
+             "array and visit them with a parallel loop, when the recursive "
+             "call along the chain is independent of the rest of the body"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> SpineChunkSize(
+    "spine-chunk-size",
+    cl::desc("number of consecutive nodes of a chain visited by one iteration "
+             "of the parallel loop of -chunk-spines"),
+    cl::init(64), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> PrefetchChildren(
+    "prefetch-children",
+    cl::desc("prefetch the children visited by the calls of a synthesized "
+             "traversal before running its first statements"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> PrefetchDistance(
+    "prefetch-distance",
+    cl::desc("number of levels of descendants prefetched by "
+             "-prefetch-children, 2 also prefetches the grandchildren"),
+    cl::init(1), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> VisitCounters(
+    "visit-counters",
+    cl::desc("count the visits of the synthesized traversals with per worker "
+             "counters, per function and per node type, instead of "
+             "incrementing _VISIT_COUNTER, cycles are counted as well when "
+             "compiled with COUNT_CYCLES"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> WorkSpan(
+    "work-span",
+    cl::desc("instrument the spawns and syncs of the parallel traversals, "
+             "when compiled with ORCHARD_WORK_SPAN the program runs serially "
+             "and reports the work, span and parallelism of each top level "
+             "fused call site"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> Trace(
+    "trace",
+    cl::desc("record the invocations of the parallel traversals and their "
+             "syncs when compiled with ORCHARD_TRACE, they are written as a "
+             "Chrome trace at exit"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<unsigned> TraceDepth(
+    "trace-depth",
+    cl::desc("deepest spawn depth of the invocations recorded by -trace"),
+    cl::init(8), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> FuseHelperLoops(
+    "fuse-helper-loops",
+    cl::desc("run the loops of the helpers annotated with tf_strict_access "
+             "that consecutive fused traversals call on the same object as "
+             "one loop, when they iterate over the same range and only "
+             "access the current element of the member arrays"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> CombineUpdates(
+    "combine-updates",
+    cl::desc("replace the additions, subtractions, multiplications and "
+             "divisions of a floating point field of the node by constants "
+             "that consecutive fused traversals apply one after the other "
+             "with a single multiply-add, which can change the rounding of "
+             "the result"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
 std::map<clang::FunctionDecl *, int> TraversalSynthesizer::FunDeclToNameId =
     std::map<clang::FunctionDecl *, int>();
 std::map<std::vector<clang::CallExpr *>, string> TraversalSynthesizer::Stubs =
@@ -38,6 +173,192 @@ std::string toBinaryString(unsigned Input) {
   return Output;
 }
 
+// Type tags of the tree classes in closed hierarchy mode
+static std::map<const CXXRecordDecl *, int> TypeTags;
+
+static int getTypeTag(const CXXRecordDecl *Record) {
+  if (!TypeTags.count(Record)) {
+    int Tag = TypeTags.size();
+    TypeTags[Record] = Tag;
+  }
+  return TypeTags[Record];
+}
+
+// Return the top most tree class that Record derives from
+static const CXXRecordDecl *getHierarchyRoot(const CXXRecordDecl *Record) {
+  for (auto &Base : Record->bases()) {
+    auto *BaseRecord = Base.getType()->getAsCXXRecordDecl();
+    if (BaseRecord && hasTreeAnnotation(BaseRecord))
+      return getHierarchyRoot(BaseRecord);
+  }
+  return Record;
+}
+
+// Return the static type of the child visited by the given calls
+static const CXXRecordDecl *
+getCalledChildType(const std::vector<clang::CallExpr *> &Calls) {
+  AccessPath AP = extractVisitedChild(Calls[0]);
+  return AP.getDeclAtIndex(AP.SplittedAccessPath.size() - 1)
+      ->getType()
+      ->getPointeeCXXRecordDecl();
+}
+
+// Return the body of a constructor of a derived class that sets the type tag,
+// nullptr if the constructor is defaulted in its class
+static const clang::CompoundStmt *
+getTagSettingBody(const clang::CXXConstructorDecl *Ctor) {
+  if (Ctor->isExplicitlyDefaulted())
+    return nullptr;
+  const clang::FunctionDecl *Definition = nullptr;
+  if (!Ctor->hasBody(Definition) || Definition->isDefaulted())
+    return nullptr;
+  return dyn_cast_or_null<clang::CompoundStmt>(Definition->getBody());
+}
+
+// Return why a constructor of Record cannot set its type tag, "" if each of
+// them can: the tag is set at the start of the constructor bodies, in a
+// defaulted constructor that gets a body, or in an injected default
+// constructor when the class declares none
+static std::string getTagSettingProblem(const CXXRecordDecl *Record) {
+  for (auto *Decl : Record->decls())
+    if (auto *Using = dyn_cast<clang::UsingDecl>(Decl))
+      if (Using->getNameInfo().getName().getNameKind() ==
+          clang::DeclarationName::CXXConstructorName)
+        return "it inherits constructors";
+
+  if (!Record->hasUserDeclaredConstructor())
+    return Record->defaultedDefaultConstructorIsDeleted()
+               ? "it cannot be given a default constructor"
+               : "";
+
+  for (auto *Ctor : Record->ctors()) {
+    if (Ctor->isImplicit() || Ctor->isDeleted() ||
+        Ctor->isCopyOrMoveConstructor())
+      continue;
+    if (Ctor->isExplicitlyDefaulted()
+            ? !clang::Rewriter::isRewritable(Ctor->getEndLoc())
+            : !getTagSettingBody(Ctor) ||
+                  !clang::Rewriter::isRewritable(
+                      getTagSettingBody(Ctor)->getLBracLoc()))
+      return "the body of one of its constructors is not visible";
+  }
+  return "";
+}
+
+// Return true if every class of the hierarchy of Record can set its type tag.
+// Otherwise the tag would keep the value of a base and the dispatch would run
+// the traversal of the wrong type, so the hierarchy keeps the virtual stubs
+static bool hasTypeTags(const CXXRecordDecl *Record) {
+  static std::map<const CXXRecordDecl *, bool> Supported;
+
+  auto *Root = getHierarchyRoot(Record);
+  if (Supported.count(Root))
+    return Supported[Root];
+  Supported[Root] = true;
+  for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[Root]) {
+    string Problem = getTagSettingProblem(DerivedType->getDefinition());
+    if (Problem == "")
+      continue;
+    Logger::getStaticLogger().logWarn(
+        "closed hierarchy: " + DerivedType->getNameAsString() +
+        " cannot set its type tag because " + Problem + ", the hierarchy of " +
+        Root->getNameAsString() + " uses the virtual stubs");
+    Supported[Root] = false;
+    break;
+  }
+  return Supported[Root];
+}
+
+// How a fused traversal behaves on a dynamic type of the visited child
+enum class LeafKind {
+  /// All the participating overrides are empty
+  Empty,
+  /// None of the participating overrides visits a child
+  Leaf,
+  Other
+};
+
+static LeafKind classifyCalls(const std::vector<clang::CallExpr *> &Calls,
+                              const CXXRecordDecl *DynamicType) {
+  LeafKind Kind = LeafKind::Empty;
+  for (auto *Call : Calls) {
+    auto *Callee = Call->getCalleeDecl()->getAsFunction();
+    auto *Method = dyn_cast<clang::CXXMethodDecl>(Callee);
+    if (DynamicType && Method && Method->isVirtual())
+      Callee = Method->getCorrespondingMethodInClass(DynamicType);
+    auto *Info = FunctionsFinder::getFunctionInfo(Callee->getDefinition());
+
+    if (Info->hasEmptyBody())
+      continue;
+    if (Info->getNumberOfTraversingCalls())
+      return LeafKind::Other;
+    Kind = LeafKind::Leaf;
+  }
+  return Kind;
+}
+
+// Split the calls of a fused traversal into chains of calls that visit the
+// same child, where a call only waits for the calls before it in its chain.
+// The calls must form the contiguous levels [FirstCallLevel, LastCallLevel]
+// of the schedule. Return no chain if that is not the case or if no child is
+// visited by more than one call
+static std::vector<std::vector<DG_Node *>>
+findPipelineChains(const std::vector<vector<DG_Node *>> &TopologicalOrder,
+                   int &FirstCallLevel, int &LastCallLevel) {
+  std::vector<std::vector<DG_Node *>> Chains;
+  FirstCallLevel = LastCallLevel = -1;
+  for (int Level = 0; Level < TopologicalOrder.size(); Level++)
+    for (auto *Node : TopologicalOrder[Level])
+      if (Node->getStatementInfo()->isCallStmt()) {
+        if (FirstCallLevel == -1)
+          FirstCallLevel = Level;
+        LastCallLevel = Level;
+      }
+  if (FirstCallLevel == -1)
+    return Chains;
+
+  std::map<clang::FieldDecl *, int> ChainOfChild;
+  std::unordered_map<DG_Node *, std::pair<int, int>> Position;
+  for (int Level = FirstCallLevel; Level <= LastCallLevel; Level++) {
+    for (auto *Node : TopologicalOrder[Level]) {
+      if (!Node->getStatementInfo()->isCallStmt())
+        return {};
+      auto *Child = Node->getStatementInfo()->getCalledChild();
+      if (!ChainOfChild.count(Child)) {
+        ChainOfChild[Child] = Chains.size();
+        Chains.emplace_back();
+      }
+      int Chain = ChainOfChild[Child];
+      auto Members = Node->isMerged()
+                         ? std::vector<DG_Node *>(
+                               Node->getMergeInfo()->MergedNodes.begin(),
+                               Node->getMergeInfo()->MergedNodes.end())
+                         : std::vector<DG_Node *>{Node};
+      for (auto *Member : Members)
+        Position[Member] = std::make_pair(Chain, (int)Chains[Chain].size());
+      Chains[Chain].push_back(Node);
+    }
+  }
+
+  bool HasLongChain = false;
+  for (auto &Chain : Chains)
+    HasLongChain |= Chain.size() > 1;
+  if (!HasLongChain)
+    return {};
+
+  // statements that are not calls all run before the calls
+  for (auto &Entry : Position)
+    for (auto &Predecessor : Entry.first->getPredecessors()) {
+      if (!Position.count(Predecessor.first))
+        continue;
+      auto &From = Position[Predecessor.first];
+      if (From.first != Entry.second.first ||
+          From.second > Entry.second.second)
+        return {};
+    }
+  return Chains;
+}
+
 unsigned TraversalSynthesizer::getNumberOfParticipatingTraversals(
     const std::vector<bool> &ParticipatingTraversals) const {
   unsigned Count = 0;
@@ -130,6 +451,448 @@ string StringReplace(std::string str, const std::string &from,
   str.replace(start_pos, from.length(), to);
   return str;
 }
+
+// Replace every occurrence of from in str, unlike StringReplace
+static string StringReplaceAll(std::string str, const std::string &from,
+                               const std::string &to) {
+  for (size_t Pos = str.find(from); Pos != std::string::npos;
+       Pos = str.find(from, Pos + to.size()))
+    str.replace(Pos, from.size(), to);
+  return str;
+}
+
+// Return true if the expression refers to the variable
+static bool refersTo(const clang::Expr *Expression,
+                     const clang::VarDecl *Variable) {
+  auto *Reference =
+      dyn_cast<clang::DeclRefExpr>(Expression->IgnoreParenImpCasts());
+  return Reference && Reference->getDecl() == Variable;
+}
+
+// Return true if the statement refers to a parameter
+static bool refersToParameter(const clang::Stmt *Stmt) {
+  if (!Stmt)
+    return false;
+  auto *Reference = dyn_cast<clang::DeclRefExpr>(Stmt);
+  if (Reference && isa<clang::ParmVarDecl>(Reference->getDecl()))
+    return true;
+  for (auto *Child : Stmt->children())
+    if (refersToParameter(Child))
+      return true;
+  return false;
+}
+
+// Return true if the subscript accesses the element Index of a member array
+// or container of the object
+static bool isElementAccess(const clang::Expr *Base,
+                            const clang::Expr *Subscript,
+                            const clang::VarDecl *Index) {
+  auto *Member = dyn_cast<clang::MemberExpr>(Base->IgnoreParenImpCasts());
+  if (!Member || !refersTo(Subscript, Index) ||
+      !isa<clang::CXXThisExpr>(Member->getBase()->IgnoreParenImpCasts()))
+    return false;
+  // pointers and references can alias the arrays of the other helpers
+  auto Type = Member->getMemberDecl()->getType();
+  return !Type->isPointerType() && !Type->isReferenceType();
+}
+
+// Return true if the statement of a loop body only accesses the element
+// Index of the member arrays, only writes them and the local variables, and
+// neither calls a function nor leaves the loop. The iteration i of a loop
+// then only depends on the iteration i of the loops fused before it
+static bool isElementWise(const clang::Stmt *Stmt,
+                          const clang::VarDecl *Index) {
+  if (!Stmt)
+    return true;
+  if (isa<clang::BreakStmt>(Stmt) || isa<clang::ContinueStmt>(Stmt) ||
+      isa<clang::ReturnStmt>(Stmt) || isa<clang::GotoStmt>(Stmt) ||
+      isa<clang::LabelStmt>(Stmt) || isa<clang::CXXConstructExpr>(Stmt) ||
+      isa<clang::CXXNewExpr>(Stmt) || isa<clang::CXXDeleteExpr>(Stmt) ||
+      isa<clang::CXXThrowExpr>(Stmt) || isa<clang::LambdaExpr>(Stmt))
+    return false;
+
+  const clang::Expr *Written = nullptr;
+  if (auto *Operator = dyn_cast<clang::CXXOperatorCallExpr>(Stmt)) {
+    if (Operator->getOperator() != clang::OO_Subscript ||
+        !isElementAccess(Operator->getArg(0), Operator->getArg(1), Index))
+      return false;
+  } else if (isa<clang::CallExpr>(Stmt)) {
+    return false;
+  } else if (auto *Subscript = dyn_cast<clang::ArraySubscriptExpr>(Stmt)) {
+    if (!isElementAccess(Subscript->getBase(), Subscript->getIdx(), Index))
+      return false;
+  } else if (auto *Binary = dyn_cast<clang::BinaryOperator>(Stmt)) {
+    if (Binary->isAssignmentOp())
+      Written = Binary->getLHS();
+  } else if (auto *Unary = dyn_cast<clang::UnaryOperator>(Stmt)) {
+    if (Unary->getOpcode() == clang::UO_AddrOf)
+      return false;
+    if (Unary->isIncrementDecrementOp())
+      Written = Unary->getSubExpr();
+  }
+
+  if (Written) {
+    Written = Written->IgnoreParenImpCasts();
+    if (auto *Reference = dyn_cast<clang::DeclRefExpr>(Written)) {
+      auto *Variable = dyn_cast<clang::VarDecl>(Reference->getDecl());
+      if (!Variable || Variable == Index || !Variable->hasLocalStorage())
+        return false;
+    } else if (!isa<clang::ArraySubscriptExpr>(Written) &&
+               !isa<clang::CXXOperatorCallExpr>(Written))
+      return false;
+  }
+
+  for (auto *Child : Stmt->children())
+    if (!isElementWise(Child, Index))
+      return false;
+  return true;
+}
+
+// Return true if the expression is an access path from the visited node
+// RootDecl, or from this if RootDecl is null, and set Path to its fields
+static bool getAccessPath(const clang::Expr *Expression,
+                          clang::ValueDecl *RootDecl,
+                          std::vector<const clang::ValueDecl *> &Path) {
+  Path.clear();
+  Expression = Expression->IgnoreParenImpCasts();
+  while (auto *Member = dyn_cast<clang::MemberExpr>(Expression)) {
+    if (!isa<clang::FieldDecl>(Member->getMemberDecl()))
+      return false;
+    Path.insert(Path.begin(), Member->getMemberDecl());
+    Expression = Member->getBase()->IgnoreParenImpCasts();
+  }
+  auto *Root = dyn_cast<clang::DeclRefExpr>(Expression);
+  return RootDecl ? Root && Root->getDecl() == RootDecl
+                  : isa<clang::CXXThisExpr>(Expression);
+}
+
+// Return true if the statement is a call of a helper whose body is a single
+// loop for (<integer> i = <Init>; i < <Bound>; i++) over the elements of the
+// member arrays, on an access path from the visited node RootDecl (or this),
+// with arguments that the helpers cannot change, and set Loop
+static bool getHelperLoop(const clang::Stmt *Stmt, clang::ValueDecl *RootDecl,
+                          const clang::SourceManager &SM,
+                          TraversalSynthesizer::HelperLoop &Loop) {
+  auto *Call = dyn_cast<clang::CXXMemberCallExpr>(Stmt->IgnoreImplicit());
+  if (!Call || !Call->getMethodDecl())
+    return false;
+  auto *Method = Call->getMethodDecl();
+  const clang::FunctionDecl *Definition = nullptr;
+  if (!hasStrictAccessAnnotation(Method) || Method->isVirtual() ||
+      !Method->getReturnType()->isVoidType() ||
+      !Method->hasBody(Definition) ||
+      SM.isInSystemHeader(Definition->getLocation()))
+    return false;
+
+  for (auto *Param : Definition->parameters())
+    if (Param->getType()->isReferenceType())
+      return false;
+  for (auto *Argument : Call->arguments()) {
+    auto *Value = Argument->IgnoreParenImpCasts();
+    auto *Reference = dyn_cast<clang::DeclRefExpr>(Value);
+    auto *Variable =
+        Reference ? dyn_cast<clang::VarDecl>(Reference->getDecl()) : nullptr;
+    if (!isa<clang::IntegerLiteral>(Value) &&
+        !isa<clang::FloatingLiteral>(Value) &&
+        !(Variable && Variable->hasLocalStorage()))
+      return false;
+  }
+
+  // the object is the same node in all the traversals of the block
+  if (!getAccessPath(Call->getImplicitObjectArgument(), RootDecl, Loop.Path))
+    return false;
+
+  auto *Body = dyn_cast<clang::CompoundStmt>(Definition->getBody());
+  if (!Body || Body->size() != 1)
+    return false;
+  auto *For = dyn_cast<clang::ForStmt>(Body->body_front());
+  if (!For || !For->getInit() || !For->getCond() || !For->getInc())
+    return false;
+  auto *Init = dyn_cast<clang::DeclStmt>(For->getInit());
+  if (!Init || !Init->isSingleDecl())
+    return false;
+  auto *Index = dyn_cast<clang::VarDecl>(Init->getSingleDecl());
+  auto *Condition = dyn_cast<clang::BinaryOperator>(For->getCond());
+  auto *Increment = dyn_cast<clang::UnaryOperator>(For->getInc());
+  if (!Index || !Index->getType()->isIntegerType() || !Index->getInit() ||
+      !Condition || Condition->getOpcode() != clang::BO_LT ||
+      !refersTo(Condition->getLHS(), Index) || !Increment ||
+      !Increment->isIncrementOp() || !refersTo(Increment->getSubExpr(), Index))
+    return false;
+
+  // the range is evaluated once for all the fused loops
+  auto &Ctx = Definition->getASTContext();
+  if (refersToParameter(Index->getInit()) ||
+      refersToParameter(Condition->getRHS()) ||
+      Index->getInit()->HasSideEffects(Ctx) ||
+      Condition->getRHS()->HasSideEffects(Ctx) ||
+      !isElementWise(For->getBody(), Index))
+    return false;
+
+  Loop.Call = Call;
+  Loop.Definition = Definition;
+  Loop.Index = Index;
+  Loop.Body = For->getBody();
+  Loop.Init = Lexer::getSourceText(
+                  CharSourceRange::getTokenRange(
+                      Index->getInit()->getSourceRange()),
+                  SM, LangOptions(), 0)
+                  .str();
+  Loop.Bound = Lexer::getSourceText(
+                   CharSourceRange::getTokenRange(
+                       Condition->getRHS()->getSourceRange()),
+                   SM, LangOptions(), 0)
+                   .str();
+  return true;
+}
+
+// Return true if the loops of the two helper calls can run as one loop
+static bool canFuseHelperLoops(const TraversalSynthesizer::HelperLoop &First,
+                               const TraversalSynthesizer::HelperLoop &Next) {
+  return First.Path == Next.Path &&
+         First.Call->getMethodDecl()->getParent() ==
+             Next.Call->getMethodDecl()->getParent() &&
+         First.Index->getType().getCanonicalType() ==
+             Next.Index->getType().getCanonicalType() &&
+         First.Init == Next.Init && First.Bound == Next.Bound;
+}
+
+static void collectReferences(const clang::Stmt *Stmt,
+                              std::map<unsigned, const clang::DeclRefExpr *>
+                                  &References,
+                              const clang::SourceManager &SM) {
+  if (!Stmt)
+    return;
+  if (auto *Reference = dyn_cast<clang::DeclRefExpr>(Stmt))
+    References[SM.getFileOffset(SM.getSpellingLoc(Reference->getLocation()))] =
+        Reference;
+  for (auto *Child : Stmt->children())
+    collectReferences(Child, References, SM);
+}
+
+// Return the source text of the statement with the references to the
+// declarations of Names renamed, or an empty string if one of them is
+// written in a macro
+static std::string
+getRenamedText(const clang::Stmt *Stmt,
+               const std::map<const clang::ValueDecl *, std::string> &Names,
+               const clang::SourceManager &SM) {
+  if (Stmt->getBeginLoc().isMacroID() || Stmt->getEndLoc().isMacroID())
+    return "";
+  std::string Text =
+      Lexer::getSourceText(CharSourceRange::getTokenRange(Stmt->getSourceRange()),
+                           SM, LangOptions(), 0)
+          .str();
+  unsigned Begin = SM.getFileOffset(Stmt->getBeginLoc());
+
+  std::map<unsigned, const clang::DeclRefExpr *> References;
+  collectReferences(Stmt, References, SM);
+  // rename from the end so that the offsets of the first references hold
+  for (auto It = References.rbegin(); It != References.rend(); ++It) {
+    auto *Reference = It->second;
+    if (!Names.count(Reference->getDecl()))
+      continue;
+    if (Reference->getLocation().isMacroID())
+      return "";
+    Text.replace(It->first - Begin,
+                 Reference->getNameInfo().getAsString().size(),
+                 Names.at(Reference->getDecl()));
+  }
+  return Text;
+}
+
+std::string
+TraversalSynthesizer::getFusedHelperCall(const std::vector<HelperLoop> &Loops,
+                                         StatementPrinter &Printer,
+                                         bool HasCXXCall) {
+  static std::set<std::pair<const CXXRecordDecl *, std::string>> FusedHelpers;
+  auto &SM = ASTCtx->getSourceManager();
+
+  string Name = "_orchard_fused";
+  string Parameters = "", Arguments = "", Bodies = "";
+  for (int I = 0; I < Loops.size(); I++) {
+    auto &Loop = Loops[I];
+    Name += "_" + Loop.Definition->getNameAsString();
+
+    // the parameters of each helper and the loop variables are renamed
+    std::map<const clang::ValueDecl *, std::string> Names;
+    Names[Loop.Index] = "_i";
+    for (auto *Param : Loop.Definition->parameters()) {
+      string Renamed = "_p" + to_string(I) + "_" + Param->getNameAsString();
+      Names[Param] = Renamed;
+      Parameters += (Parameters.empty() ? "" : ", ") +
+                    Param->getType().getAsString() + " " + Renamed;
+    }
+    for (auto *Argument : Loop.Call->arguments())
+      Arguments += (Arguments.empty() ? "" : ", ") +
+                   Printer.printStmt(Argument, SM, Loop.RootDecl, "",
+                                     Loop.TraversalIndex, HasCXXCall,
+                                     HasCXXCall);
+
+    string Body = getRenamedText(Loop.Body, Names, SM);
+    if (Body.empty())
+      return "";
+    Bodies += isa<clang::CompoundStmt>(Loop.Body) ? Body + "\n"
+                                                  : "{ " + Body + "; }\n";
+  }
+
+  auto *Record = Loops[0].Call->getMethodDecl()->getParent();
+  if (!FusedHelpers.count(std::make_pair(Record, Name + Parameters))) {
+    FusedHelpers.insert(std::make_pair(Record, Name + Parameters));
+    string Index = Loops[0].Index->getType().getAsString();
+    Rewriter.InsertText(Record->getDefinition()->getEndLoc(),
+                        "public:\ninline void " + Name + "(" + Parameters +
+                            ") {\nfor (" + Index + " _i = " + Loops[0].Init +
+                            "; _i < " + Loops[0].Bound + "; _i++) {\n" +
+                            Bodies + "}\n}\n");
+  }
+
+  auto *Callee =
+      dyn_cast<clang::MemberExpr>(Loops[0].Call->getCallee()->IgnoreParens());
+  return Printer.printStmt(Loops[0].Call->getImplicitObjectArgument(), SM,
+                           Loops[0].RootDecl, "", Loops[0].TraversalIndex,
+                           HasCXXCall, HasCXXCall) +
+         (Callee && !Callee->isArrow() ? "." : "->") + Name + "(" + Arguments +
+         ");\n";
+}
+
+// Return true if the operand of an update of Field only reads variables and
+// fields other than Field, so that it keeps its value along the updates
+static bool isUpdateOperand(const clang::Stmt *Stmt,
+                            const clang::ValueDecl *Field) {
+  if (auto *Reference = dyn_cast<clang::DeclRefExpr>(Stmt)) {
+    auto *Variable = dyn_cast<clang::VarDecl>(Reference->getDecl());
+    return isa<clang::EnumConstantDecl>(Reference->getDecl()) ||
+           (Variable && !Variable->getType()->isReferenceType());
+  }
+  if (auto *Member = dyn_cast<clang::MemberExpr>(Stmt)) {
+    if (Member->getMemberDecl() == Field ||
+        !isa<clang::FieldDecl>(Member->getMemberDecl()) ||
+        Member->getMemberDecl()->getType()->isReferenceType())
+      return false;
+  } else if (auto *Binary = dyn_cast<clang::BinaryOperator>(Stmt)) {
+    if (Binary->isAssignmentOp() || Binary->getOpcode() == clang::BO_Comma)
+      return false;
+  } else if (auto *Unary = dyn_cast<clang::UnaryOperator>(Stmt)) {
+    if (Unary->getOpcode() != clang::UO_Minus &&
+        Unary->getOpcode() != clang::UO_Plus &&
+        Unary->getOpcode() != clang::UO_Not &&
+        Unary->getOpcode() != clang::UO_LNot)
+      return false;
+  } else if (!isa<clang::IntegerLiteral>(Stmt) &&
+             !isa<clang::FloatingLiteral>(Stmt) &&
+             !isa<clang::ParenExpr>(Stmt) && !isa<clang::CastExpr>(Stmt) &&
+             !isa<clang::CXXThisExpr>(Stmt))
+    return false;
+
+  for (auto *Child : Stmt->children())
+    if (!isUpdateOperand(Child, Field))
+      return false;
+  return true;
+}
+
+// Return true if the statement is an affine update of a floating point field
+// of the visited node RootDecl (or this), and set Update
+static bool getAffineUpdate(const clang::Stmt *Stmt, clang::ValueDecl *RootDecl,
+                            TraversalSynthesizer::AffineUpdate &Update) {
+  auto *Assignment = dyn_cast<clang::BinaryOperator>(Stmt->IgnoreImplicit());
+  if (!Assignment || !Assignment->isAssignmentOp() ||
+      !Assignment->getLHS()->getType()->isRealFloatingType() ||
+      !getAccessPath(Assignment->getLHS(), RootDecl, Update.Path) ||
+      Update.Path.empty())
+    return false;
+
+  clang::BinaryOperatorKind Opcode;
+  const clang::Expr *Operand;
+  std::vector<const clang::ValueDecl *> Path;
+  if (isa<clang::CompoundAssignOperator>(Assignment)) {
+    Opcode = clang::BinaryOperator::getOpForCompoundAssignment(
+        Assignment->getOpcode());
+    Operand = Assignment->getRHS();
+  } else if (Assignment->getOpcode() == clang::BO_Assign) {
+    // x = x op e, or x = e op x for the commutative operators
+    auto *Value = dyn_cast<clang::BinaryOperator>(
+        Assignment->getRHS()->IgnoreParenImpCasts());
+    if (!Value)
+      return false;
+    Opcode = Value->getOpcode();
+    if (getAccessPath(Value->getLHS(), RootDecl, Path) && Path == Update.Path)
+      Operand = Value->getRHS();
+    else if ((Opcode == clang::BO_Add || Opcode == clang::BO_Mul) &&
+             getAccessPath(Value->getRHS(), RootDecl, Path) &&
+             Path == Update.Path)
+      Operand = Value->getLHS();
+    else
+      return false;
+  } else
+    return false;
+
+  if ((Opcode != clang::BO_Add && Opcode != clang::BO_Sub &&
+       Opcode != clang::BO_Mul && Opcode != clang::BO_Div) ||
+      !isUpdateOperand(Operand->IgnoreParenImpCasts(), Update.Path.back()))
+    return false;
+
+  Update.Target = Assignment->getLHS();
+  Update.Operand = Operand;
+  Update.Opcode = Opcode;
+  return true;
+}
+
+std::string
+TraversalSynthesizer::getCombinedUpdate(const std::vector<AffineUpdate> &Updates,
+                                        StatementPrinter &Printer,
+                                        bool HasCXXCall) {
+  auto &SM = ASTCtx->getSourceManager();
+  string Type = Updates[0].Target->getType().getUnqualifiedType().getAsString();
+
+  // the updates compose to x * Scale + Offset, where an empty scale is 1 and
+  // an empty offset is 0. Divisions divide the scale and the offset rather
+  // than multiplying them by the reciprocal
+  string Scale = "", Offset = "";
+  for (auto &Update : Updates) {
+    string Operand =
+        "(" +
+        Printer.printStmt(Update.Operand, SM, Update.RootDecl, "",
+                          Update.TraversalIndex, HasCXXCall, HasCXXCall) +
+        ")";
+    switch (Update.Opcode) {
+    case clang::BO_Add:
+      Offset = Offset.empty() ? Operand : "(" + Offset + " + " + Operand + ")";
+      break;
+    case clang::BO_Sub:
+      Offset = Offset.empty() ? "-" + Operand
+                              : "(" + Offset + " - " + Operand + ")";
+      break;
+    default: {
+      string Operator = Update.Opcode == clang::BO_Mul ? " * " : " / ";
+      if (!Scale.empty())
+        Scale = "(" + Scale + Operator + Operand + ")";
+      else
+        Scale = Update.Opcode == clang::BO_Mul
+                    ? Operand
+                    : "((" + Type + ")1" + Operator + Operand + ")";
+      if (!Offset.empty())
+        Offset = "(" + Offset + Operator + Operand + ")";
+    }
+    }
+  }
+
+  string Prefix = "_u" + to_string(Updates[0].TraversalIndex) + "_";
+  string Target =
+      Printer.printStmt(Updates[0].Target, SM, Updates[0].RootDecl, "",
+                        Updates[0].TraversalIndex, HasCXXCall, HasCXXCall);
+  string Text = "", Value = Target;
+  if (!Scale.empty()) {
+    Text += "const " + Type + " " + Prefix + "scale = " + Scale + ";\n";
+    Value += " * " + Prefix + "scale";
+  }
+  if (!Offset.empty()) {
+    Text += "const " + Type + " " + Prefix + "offset = " + Offset + ";\n";
+    Value += " + " + Prefix + "offset";
+  }
+  return Text + Target + " = " + Value + ";\n";
+}
+
 void TraversalSynthesizer::
     setBlockSubPart(/*
 string &Decls,*/ std::string &BlockPart,
@@ -140,6 +903,45 @@ string &Decls,*/ std::string &BlockPart,
                     bool HasCXXCall) {
   StatementPrinter Printer;
 
+  for (int TraversalIndex = 0;
+       TraversalIndex < ParticipatingTraversalsDecl.size(); TraversalIndex++) {
+    const clang::FieldDecl *ResultField = nullptr;
+    int Slot = getShortCircuitSlot(ParticipatingTraversalsDecl[TraversalIndex],
+                                   &ResultField);
+    if (Slot != -1)
+      Printer.setShortCircuit(TraversalIndex, ResultField, Slot);
+  }
+
+  // the traversals whose part of the block is a single call of a helper loop
+  // or a single affine update of a field
+  std::vector<HelperLoop> HelperLoops(ParticipatingTraversalsDecl.size());
+  std::vector<AffineUpdate> Updates(ParticipatingTraversalsDecl.size());
+  for (int TraversalIndex = 0;
+       (opts::FuseHelperLoops || opts::CombineUpdates) &&
+       TraversalIndex < ParticipatingTraversalsDecl.size();
+       TraversalIndex++) {
+    auto *Decl = ParticipatingTraversalsDecl[TraversalIndex];
+    auto *RootDecl = FunctionsFinder::getFunctionInfo(Decl)->isGlobal()
+                         ? Decl->getParamDecl(0)
+                         : nullptr;
+    HelperLoops[TraversalIndex].TraversalIndex =
+        Updates[TraversalIndex].TraversalIndex = TraversalIndex;
+    HelperLoops[TraversalIndex].RootDecl = Updates[TraversalIndex].RootDecl =
+        RootDecl;
+    if (!Statements.count(TraversalIndex) ||
+        Statements[TraversalIndex].size() != 1)
+      continue;
+
+    auto *Stmt = Statements[TraversalIndex][0]->getStatementInfo()->Stmt;
+    if (opts::FuseHelperLoops)
+      getHelperLoop(Stmt, RootDecl, ASTCtx->getSourceManager(),
+                    HelperLoops[TraversalIndex]);
+    // the updates of the result of a short-circuitable traversal are
+    // published one by one
+    if (opts::CombineUpdates && getShortCircuitSlot(Decl) == -1)
+      getAffineUpdate(Stmt, RootDecl, Updates[TraversalIndex]);
+  }
+
   for (int TraversalIndex = 0;
        TraversalIndex < ParticipatingTraversalsDecl.size(); TraversalIndex++) {
     std::string Declarations = "";
@@ -147,6 +949,66 @@ string &Decls,*/ std::string &BlockPart,
     if (!Statements.count(TraversalIndex))
       continue;
 
+    // consecutive calls of helper loops on the same object run as one loop,
+    // and consecutive affine updates of the same field as one update, when
+    // none of their traversals has returned. The traversals that do not
+    // visit this block are skipped
+    std::vector<int> Chain;
+    string FusedPart = "";
+    std::vector<HelperLoop> Loops;
+    for (int Next = TraversalIndex; HelperLoops[TraversalIndex].Call &&
+                                    Next < ParticipatingTraversalsDecl.size();
+         Next++) {
+      if (!Statements.count(Next))
+        continue;
+      if (!HelperLoops[Next].Call ||
+          !canFuseHelperLoops(HelperLoops[TraversalIndex], HelperLoops[Next]))
+        break;
+      Loops.push_back(HelperLoops[Next]);
+    }
+    if (Loops.size() > 1)
+      FusedPart = getFusedHelperCall(Loops, Printer, HasCXXCall);
+    if (!FusedPart.empty())
+      for (auto &Loop : Loops)
+        Chain.push_back(Loop.TraversalIndex);
+
+    std::vector<AffineUpdate> Combined;
+    for (int Next = TraversalIndex;
+         FusedPart.empty() && Updates[TraversalIndex].Target &&
+         Next < ParticipatingTraversalsDecl.size();
+         Next++) {
+      if (!Statements.count(Next))
+        continue;
+      if (!Updates[Next].Target ||
+          Updates[Next].Path != Updates[TraversalIndex].Path)
+        break;
+      Combined.push_back(Updates[Next]);
+    }
+    if (Combined.size() > 1) {
+      FusedPart = getCombinedUpdate(Combined, Printer, HasCXXCall);
+      for (auto &Update : Combined)
+        Chain.push_back(Update.TraversalIndex);
+    }
+
+    if (!FusedPart.empty()) {
+      unsigned Mask = 0;
+      for (int Index : Chain)
+        Mask |= 1 << Index;
+      BlockPart += "if ((truncate_flags & " + toBinaryString(Mask) + ") == " +
+                   toBinaryString(Mask) + ") {\n" + FusedPart + "} else {\n";
+      for (int Index : Chain)
+        BlockPart += "if (truncate_flags &" + toBinaryString((1 << Index)) +
+                     ") {\n" +
+                     Printer.printStmt(
+                         Statements[Index][0]->getStatementInfo()->Stmt,
+                         ASTCtx->getSourceManager(), HelperLoops[Index].RootDecl,
+                         "", Index, HasCXXCall, HasCXXCall) +
+                     "}\n";
+      BlockPart += "}\n";
+      TraversalIndex = Chain.back();
+      continue;
+    }
+
     auto *Decl = ParticipatingTraversalsDecl[TraversalIndex];
 
     string NextLabel = "_label_B" + to_string(BlockId) + +"F" +
@@ -291,6 +1153,28 @@ void TraversalSynthesizer::setCallPart(
 
   CallPartText += AdjustedFlagCode;
 
+  // A traversal whose guard holds returns right away and a cancelled
+  // short-circuitable traversal has nothing left to do, drop them before the
+  // call and do not call (or spawn) at all if none of the traversals is left
+  bool HasHoistedGuard = false;
+  for (int i = 0; i < NextCallNodes.size(); i++) {
+    string Guard = opts::HoistGuards
+                       ? getHoistedGuard(NextCallNodes[i], HasCXXCall)
+                       : "";
+    int Slot = getShortCircuitSlot(
+        NextCallNodes[i]->getStatementInfo()->getCalledFunction());
+    if (Slot != -1)
+      Guard += (Guard == "" ? "" : " || ") + string("_orchard_short_circuited(") +
+               to_string(Slot) + ")";
+    if (Guard == "")
+      continue;
+    CallPartText += "if (" + Guard + ") AdjustedTruncateFlags &= ~" +
+                    toBinaryString(1 << i) + ";\n";
+    HasHoistedGuard = true;
+  }
+  if (HasHoistedGuard)
+    CallPartText += "if (AdjustedTruncateFlags) {\n";
+
   std::vector<clang::CallExpr *> NexTCallExpressions;
 
   for (auto *Node : NextCallNodes)
@@ -309,12 +1193,57 @@ void TraversalSynthesizer::setCallPart(
       HasVirtual = true;
   }
 
+  // Classify the possible types of the child: a call that is empty for all of
+  // them is dropped, leaves do not need a task. With type tags the empty and
+  // leaf types are handled at the call site
+  std::vector<const CXXRecordDecl *> DynamicTypes;
+  if (HasVirtual) {
+    DynamicTypes.push_back(getCalledChildType(NexTCallExpressions));
+    for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[DynamicTypes[0]])
+      DynamicTypes.push_back(DerivedType);
+  } else
+    DynamicTypes.push_back(nullptr);
+
+  std::vector<const CXXRecordDecl *> EmptyTypes;
+  std::vector<const CXXRecordDecl *> LeafTypes;
+  bool AllLeaves = opts::ElideLeafCalls;
+  if (opts::ElideLeafCalls) {
+    for (auto *DynamicType : DynamicTypes) {
+      switch (classifyCalls(NexTCallExpressions, DynamicType)) {
+      case LeafKind::Empty:
+        EmptyTypes.push_back(DynamicType);
+        break;
+      case LeafKind::Leaf:
+        LeafTypes.push_back(DynamicType);
+        break;
+      case LeafKind::Other:
+        AllLeaves = false;
+      }
+    }
+  }
+
+  if (EmptyTypes.size() == DynamicTypes.size()) {
+    CallPartText = "/*empty call elided*/\n";
+    return;
+  }
+  if (AllLeaves)
+    isParallel = 3;
+  bool DispatchByTag = opts::ClosedHierarchy &&
+                       hasTypeTags(getCalledChildType(NexTCallExpressions));
+  bool DispatchLeavesByTag = HasVirtual && DispatchByTag &&
+                             (EmptyTypes.size() || LeafTypes.size());
+
   std::string NextCallName;
   string NextCallParamsText;
 
   if (!HasVirtual)
     NextCallName = createName(NexTCallExpressions, false, nullptr);
-  else
+  else if (DispatchByTag) {
+    // the dispatcher takes the child as its first argument like a non virtual
+    // fused traversal
+    NextCallName = getTagDispatcher(NexTCallExpressions);
+    HasVirtual = false;
+  } else
     NextCallName = getVirtualStub(NexTCallExpressions);
 
   // if (NextCallName == "__virtualStub14")
@@ -333,6 +1262,42 @@ void TraversalSynthesizer::setCallPart(
                 ->getParamDecl(0)
           : nullptr;
 
+  if (DispatchLeavesByTag) {
+    string ChildText = Printer.printStmt(
+        CallNode->getStatementInfo()
+            ->Stmt->child_begin()
+            ->child_begin()
+            ->IgnoreImplicit(),
+        ASTCtx->getSourceManager(), RootDeclCallNode, "",
+        CallNode->getTraversalId(), HasCXXCall, HasCXXCall);
+
+    string ArgumentsText = "";
+    for (auto *CallNode : NextCallNodes) {
+      auto *CallExpr =
+          dyn_cast<clang::CallExpr>(CallNode->getStatementInfo()->Stmt);
+      for (int ArgIdx = 0; ArgIdx < CallExpr->getNumArgs(); ArgIdx++)
+        ArgumentsText +=
+            ", " + Printer.printStmt(CallExpr->getArg(ArgIdx),
+                                     ASTCtx->getSourceManager(),
+                                     RootDeclCallNode, "not-used",
+                                     CallNode->getTraversalId(), HasCXXCall,
+                                     HasCXXCall);
+    }
+
+    CallPartText += "switch (" + ChildText + "->_orchard_tag) {\n";
+    for (auto *EmptyType : EmptyTypes)
+      CallPartText += "case " + to_string(getTypeTag(EmptyType)) + ":\n";
+    if (EmptyTypes.size())
+      CallPartText += "break;\n";
+    for (auto *LeafType : LeafTypes)
+      CallPartText += "case " + to_string(getTypeTag(LeafType)) + ": " +
+                      createName(NexTCallExpressions, true, LeafType) +
+                      "_serial((" + LeafType->getNameAsString() + " *)" +
+                      ChildText + ArgumentsText +
+                      ", AdjustedTruncateFlags); break;\n";
+    CallPartText += "default: {\n";
+  }
+
   // Create the call
   // Adding code for depth control
 
@@ -555,6 +1520,7 @@ void TraversalSynthesizer::setCallPart(
       CallPartText += " {";
       CallPartText += "\n";
     }
+    size_t SerialCallBegin = CallPartText.size();
 
     /***************************************************************************************************************************************************/
 
@@ -754,6 +1720,53 @@ void TraversalSynthesizer::setCallPart(
 
     CallPartText += NextCallParamsText;
     CallPartText += ");";
+
+    // Leave a placeholder that is replaced by the body of the callee (or by
+    // the call itself) once all the bodies are synthesized, see
+    // expandUnrolledCalls
+    if (isParallel == 3 && (opts::UnrollDepth || opts::IterativeSerial) &&
+        !HasVirtual && !DispatchLeavesByTag) {
+      UnrollSite Site;
+      Site.CalleeName = SerialCallName;
+      Site.CallText = CallPartText.substr(SerialCallBegin);
+
+      if (CallNode->getStatementInfo()->Stmt->getStmtClass() ==
+          clang::Stmt::CallExprClass)
+        Site.Arguments.push_back(Printer.printStmt(
+            dyn_cast<clang::CallExpr>(CallNode->getStatementInfo()->Stmt)
+                ->getArg(0),
+            ASTCtx->getSourceManager(), RootDeclCallNode, "",
+            CallNode->getTraversalId(), HasCXXCall, HasCXXCall));
+      else
+        Site.Arguments.push_back(Printer.printStmt(
+            CallNode->getStatementInfo()
+                ->Stmt->child_begin()
+                ->child_begin()
+                ->IgnoreImplicit(),
+            ASTCtx->getSourceManager(), RootDeclCallNode, "",
+            CallNode->getTraversalId(), HasCXXCall, HasCXXCall));
+
+      for (auto *CallNode : NextCallNodes) {
+        auto *CallExpr =
+            dyn_cast<clang::CallExpr>(CallNode->getStatementInfo()->Stmt);
+        for (int ArgIdx =
+                 CallNode->getStatementInfo()->getEnclosingFunction()->isGlobal()
+                     ? 1
+                     : 0;
+             ArgIdx < CallExpr->getNumArgs(); ArgIdx++)
+          Site.Arguments.push_back(Printer.printStmt(
+              CallExpr->getArg(ArgIdx), ASTCtx->getSourceManager(),
+              RootDeclCallNode, "not-used", CallNode->getTraversalId(),
+              HasCXXCall, HasCXXCall));
+      }
+      Site.Arguments.push_back("AdjustedTruncateFlags");
+
+      CallPartText.resize(SerialCallBegin);
+      CallPartText += "/*@orchard_unroll " + to_string(UnrollSites.size()) +
+                      "@*/";
+      UnrollSites.push_back(Site);
+    }
+
     CallPartText += "}";
 
     if (isParallel == 2) {
@@ -761,9 +1774,173 @@ void TraversalSynthesizer::setCallPart(
     }
   }
 
+  if (DispatchLeavesByTag)
+    CallPartText += "}}";
+  if (HasHoistedGuard)
+    CallPartText += "}";
+
   return;
 }
 
+std::string TraversalSynthesizer::getHoistedGuard(DG_Node *CallNode,
+                                                  bool HasCXXCall) {
+  auto *CallInfo = CallNode->getStatementInfo();
+  auto *Callee = CallInfo->getCalledFunction()->getDefinition();
+
+  // A virtual call can dispatch to any override, the guard is hoisted only if
+  // every non empty override starts with the same one
+  std::vector<FunctionAnalyzer *> PossibleCallees;
+  PossibleCallees.push_back(FunctionsFinder::getFunctionInfo(Callee));
+  if (PossibleCallees[0]->isVirtual()) {
+    for (auto *DerivedRecord :
+         RecordsAnalyzer::DerivedRecords[CallInfo->getTraversedTypeDecl()]) {
+      auto *Override = dyn_cast<clang::CXXMethodDecl>(Callee)
+                           ->getCorrespondingMethodInClass(DerivedRecord);
+      if (!Override || !Override->getDefinition())
+        return "";
+      PossibleCallees.push_back(
+          FunctionsFinder::getFunctionInfo(Override->getDefinition()));
+    }
+  }
+
+  string GuardTemplate;
+  for (auto *Info : PossibleCallees) {
+    if (Info->hasEmptyBody())
+      continue;
+    if (Info->getGuardTemplate() == "" ||
+        (GuardTemplate != "" && GuardTemplate != Info->getGuardTemplate()))
+      return "";
+    GuardTemplate = Info->getGuardTemplate();
+  }
+  if (GuardTemplate == "")
+    return "";
+
+  // Substitute the parameters with the arguments of the call
+  StatementPrinter Printer;
+  auto *CallExpr = dyn_cast<clang::CallExpr>(CallInfo->Stmt);
+  auto *RootDecl = CallInfo->getEnclosingFunction()->isGlobal()
+                       ? CallInfo->getEnclosingFunction()
+                             ->getFunctionDecl()
+                             ->getParamDecl(0)
+                       : nullptr;
+  string Guard;
+  for (unsigned i = 0; i < GuardTemplate.size(); i++) {
+    if (GuardTemplate[i] != '$') {
+      Guard += GuardTemplate[i];
+      continue;
+    }
+    unsigned ArgIdx = 0;
+    while (i + 1 < GuardTemplate.size() && isdigit(GuardTemplate[i + 1]))
+      ArgIdx = ArgIdx * 10 + (GuardTemplate[++i] - '0');
+    // the argument is evaluated again by the call
+    if (ArgIdx >= CallExpr->getNumArgs() ||
+        CallExpr->getArg(ArgIdx)->HasSideEffects(*ASTCtx))
+      return "";
+    Guard += "(" +
+             Printer.printStmt(CallExpr->getArg(ArgIdx),
+                               ASTCtx->getSourceManager(), RootDecl, "not-used",
+                               CallNode->getTraversalId(), HasCXXCall,
+                               HasCXXCall) +
+             ")";
+  }
+  return Guard;
+}
+
+// Cancellation slots of the short-circuitable traversals, all the overrides
+// of a virtual traversal share the slot of the method they override
+static std::map<const clang::FunctionDecl *, int> ShortCircuitSlots;
+
+static const clang::FieldDecl *findField(const clang::CXXRecordDecl *Record,
+                                         StringRef Name) {
+  for (auto *Field : Record->fields())
+    if (Field->getName() == Name)
+      return Field;
+  for (auto &Base : Record->bases())
+    if (auto *Field = findField(Base.getType()->getAsCXXRecordDecl(), Name))
+      return Field;
+  return nullptr;
+}
+
+int TraversalSynthesizer::getShortCircuitSlot(
+    clang::FunctionDecl *Traversal, const clang::FieldDecl **ResultField) {
+  // the annotation can be on the traversal or on a method it overrides
+  const clang::FunctionDecl *Root = Traversal->getCanonicalDecl();
+  StringRef FieldName = getShortCircuitField(Traversal);
+  while (auto *Method = dyn_cast<clang::CXXMethodDecl>(Root)) {
+    if (FieldName == "")
+      FieldName = getShortCircuitField(Method);
+    if (!Method->size_overridden_methods())
+      break;
+    Root = (*Method->begin_overridden_methods())->getCanonicalDecl();
+  }
+  if (FieldName == "")
+    return -1;
+
+  const clang::CXXRecordDecl *Record =
+      FunctionsFinder::getFunctionInfo(Traversal->getDefinition())->isGlobal()
+          ? Traversal->getParamDecl(0)->getType()->getPointeeCXXRecordDecl()
+          : dyn_cast<clang::CXXMethodDecl>(Traversal)->getParent();
+  const clang::FieldDecl *Field = findField(Record, FieldName);
+  if (!Field) {
+    Logger::getStaticLogger().logError(
+        "short-circuit result field " + FieldName.str() + " not found in " +
+        Record->getNameAsString());
+    return -1;
+  }
+  if (ResultField)
+    *ResultField = Field;
+
+  if (!ShortCircuitSlots.count(Root)) {
+    if (ShortCircuitSlots.size() == 64) {
+      Logger::getStaticLogger().logError(
+          "too many short-circuitable traversals");
+      return -1;
+    }
+    int Slot = ShortCircuitSlots.size();
+    ShortCircuitSlots[Root] = Slot;
+  }
+  return ShortCircuitSlots[Root];
+}
+
+std::string TraversalSynthesizer::getShortCircuitEntryCheck(
+    const std::vector<clang::FunctionDecl *> &ParticipatingTraversalsDecl) {
+  string Check = "";
+  for (int i = 0; i < ParticipatingTraversalsDecl.size(); i++) {
+    int Slot = getShortCircuitSlot(ParticipatingTraversalsDecl[i]);
+    if (Slot == -1)
+      continue;
+    Check += "if ((truncate_flags & " + toBinaryString(1 << i) +
+             ") && _orchard_short_circuited(" + to_string(Slot) +
+             ")) truncate_flags &= ~" + toBinaryString(1 << i) + ";\n";
+  }
+  return Check;
+}
+
+void TraversalSynthesizer::setHeavyStmtPart(
+    std::string &HeavyStmtText,
+    const std::vector<clang::FunctionDecl *> &ParticipatingTraversalsDecl,
+    DG_Node *StmtNode, bool HasCXXCall, bool Spawn) {
+  StatementPrinter Printer;
+  int TraversalIndex = StmtNode->getTraversalId();
+  auto *Decl = ParticipatingTraversalsDecl[TraversalIndex];
+
+  // heavy statements have no return, the exit label is never used
+  string StmtText = Printer.printStmt(
+      StmtNode->getStatementInfo()->Stmt, ASTCtx->getSourceManager(),
+      FunctionsFinder::getFunctionInfo(Decl)->isGlobal()
+          ? Decl->getParamDecl(0)
+          : nullptr,
+      "not-used", TraversalIndex, HasCXXCall, HasCXXCall);
+
+  HeavyStmtText = "/*Heavy Statement*/if (truncate_flags &" +
+                  toBinaryString(1 << TraversalIndex) + ") {\n";
+  if (Spawn)
+    HeavyStmtText += "cilk_spawn [&]() {\n" + StmtText + "}();\n";
+  else
+    HeavyStmtText += StmtText;
+  HeavyStmtText += "}\n";
+}
+
 const clang::CXXRecordDecl *
 extractDeclTraversedType(clang::FunctionDecl *FuncDecl) {
   auto *FunctionInfo =
@@ -797,6 +1974,123 @@ const clang::CXXRecordDecl *getHighestCommonTraversedType(
   }
   return HighestCommon;
 }
+// Return the code that counts a visit of the synthesized Function on a node
+// of Type, and measures its cycles if Cycles is set
+static std::string getVisitCounting(const std::string &Function,
+                                    const std::string &Type, bool Cycles) {
+  if (!opts::VisitCounters)
+    return "\n#ifdef COUNT_VISITS \n _VISIT_COUNTER++;\n #endif \n";
+
+  string Text = "\n#if defined(COUNT_VISITS) || defined(COUNT_CYCLES)\n"
+                "static int _orchard_site = _orchard_counter_site(\"" +
+                Function + "\", \"" + Type + "\");\n#endif\n";
+  Text += "#ifdef COUNT_VISITS\n_orchard_count_visit(_orchard_site);\n#endif\n";
+  if (Cycles)
+    Text += "#ifdef COUNT_CYCLES\n_orchard_cycle_scope "
+            "_orchard_cycles(_orchard_site);\n#endif\n";
+  return Text;
+}
+
+// Route the spawns, syncs and parallel loops of Text through the macros of
+// the work/span instrumentation, see -work-span, and record the syncs for
+// -trace
+static std::string instrumentParallelCode(std::string Text) {
+  static const string TracedSync =
+      "{_ORCHARD_TRACE_SYNC_BEGIN cilk_sync; _ORCHARD_TRACE_SYNC_END}";
+  if (opts::Trace)
+    for (size_t Pos = Text.find("cilk_sync;"); Pos != string::npos;
+         Pos = Text.find("cilk_sync;", Pos + TracedSync.size()))
+      Text.replace(Pos, 10, TracedSync);
+  if (!opts::WorkSpan)
+    return Text;
+  for (auto &Keyword : {std::make_pair(string("cilk_spawn "),
+                                       string("_ORCHARD_SPAWN ")),
+                        std::make_pair(string("cilk_sync;"),
+                                       string("_ORCHARD_SYNC;")),
+                        std::make_pair(string("cilk_for "),
+                                       string("_ORCHARD_FOR "))})
+    for (size_t Pos = Text.find(Keyword.first); Pos != string::npos;
+         Pos = Text.find(Keyword.first, Pos + Keyword.second.size()))
+      Text.replace(Pos, Keyword.first.size(), Keyword.second);
+  return Text;
+}
+
+// Collect the public child fields of Record and of its bases, the only ones
+// that can be read from the synthesized code of another class
+static void collectPublicChildren(const CXXRecordDecl *Record,
+                                  std::vector<clang::FieldDecl *> &Fields) {
+  for (auto &Base : Record->bases())
+    if (auto *BaseRecord = Base.getType()->getAsCXXRecordDecl())
+      if (Base.getAccessSpecifier() == clang::AS_public)
+        collectPublicChildren(BaseRecord, Fields);
+  for (auto *Field : Record->fields())
+    if (Field->getAccess() == clang::AS_public && hasChildAnnotation(Field))
+      Fields.push_back(Field);
+}
+
+std::string TraversalSynthesizer::getChildPrefetches(
+    const std::vector<vector<DG_Node *>> &TopologicalOrder, bool HasCXXCall) {
+  if (!opts::PrefetchChildren || !opts::PrefetchDistance)
+    return "";
+
+  // the visited children in the order of the calls
+  StatementPrinter Printer;
+  std::vector<std::pair<string, const CXXRecordDecl *>> Children;
+  for (auto &Level : TopologicalOrder)
+    for (auto *Node : Level) {
+      auto *StmtInfo = Node->getStatementInfo();
+      if (!StmtInfo->isCallStmt())
+        continue;
+      auto *RootDecl = StmtInfo->getEnclosingFunction()->isGlobal()
+                           ? StmtInfo->getEnclosingFunction()
+                                 ->getFunctionDecl()
+                                 ->getParamDecl(0)
+                           : nullptr;
+      clang::Stmt *ChildExpr =
+          StmtInfo->Stmt->getStmtClass() == clang::Stmt::CallExprClass
+              ? dyn_cast<clang::CallExpr>(StmtInfo->Stmt)->getArg(0)
+              : StmtInfo->Stmt->child_begin()->child_begin()->IgnoreImplicit();
+      string ChildText = Printer.printStmt(
+          ChildExpr, ASTCtx->getSourceManager(), RootDecl, "",
+          Node->getTraversalId(), HasCXXCall, HasCXXCall);
+      auto *ChildType =
+          StmtInfo->getCalledChild()->getType()->getPointeeCXXRecordDecl();
+
+      bool Seen = false;
+      for (auto &Child : Children)
+        Seen |= Child.first == ChildText;
+      if (!Seen)
+        Children.push_back(std::make_pair(ChildText, ChildType));
+    }
+
+  // one level of descendants after the other, the loads of a level overlap
+  // each other, a null pointer is never dereferenced
+  const unsigned MaxPrefetches = 32;
+  unsigned Prefetches = 0;
+  string Text = "";
+  for (unsigned Level = 1; Level <= opts::PrefetchDistance && Children.size();
+       Level++) {
+    std::vector<std::pair<string, const CXXRecordDecl *>> Next;
+    for (auto &Child : Children) {
+      if (Prefetches++ == MaxPrefetches)
+        return Text;
+      Text += "__builtin_prefetch(" + Child.first + ");\n";
+      if (Level == opts::PrefetchDistance || !Child.second ||
+          !Child.second->getDefinition())
+        continue;
+      std::vector<clang::FieldDecl *> Fields;
+      collectPublicChildren(Child.second->getDefinition(), Fields);
+      for (auto *Field : Fields)
+        Next.push_back(std::make_pair(
+            "(" + Child.first + " ? " + Child.first + "->" +
+                Field->getNameAsString() + " : nullptr)",
+            Field->getType()->getPointeeCXXRecordDecl()));
+    }
+    Children = Next;
+  }
+  return Text;
+}
+
 void TraversalSynthesizer::generateWriteBackInfo(
     const std::vector<clang::CallExpr *> &ParticipatingCalls,
     const std::vector<vector<DG_Node *>> &TopologicalOrder, bool HasVirtual,
@@ -836,6 +2130,7 @@ void TraversalSynthesizer::generateWriteBackInfo(
 
   WriteBackInfo->ParticipatingCalls = ParticipatingCalls;
   WriteBackInfo->FunctionName = idName;
+  FieldLayoutAdvisor::recordTraversal(idName, TopologicalOrder);
 
   // create forward declaration for parallel part
   WriteBackInfo->ForwardDeclaration = "void " + idName + "_parallel" + "(";
@@ -905,15 +2200,46 @@ void TraversalSynthesizer::generateWriteBackInfo(
     }
   }
 
+  string VisitedTypeName =
+      DerivedType
+          ? DerivedType->getNameAsString()
+          : getHighestCommonTraversedType(TraversalsDeclarationsList)
+                ->getNameAsString();
+  if (opts::VisitCounters)
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            ParticipatingCalls[0]->getBeginLoc(),
+                            RuntimeSupport::VisitCounters);
   string VisitsCounting =
-      "\n#ifdef COUNT_VISITS \n _VISIT_COUNTER++;\n #endif \n";
-
+      getVisitCounting(idName + "_parallel", VisitedTypeName, true);
+
+  // the strands of a parallel visit are accounted in its own frame
+  if (opts::WorkSpan)
+    WriteBackInfo->Body += "_ORCHARD_WS_FRAME\n";
+  if (opts::Trace) {
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            ParticipatingCalls[0]->getBeginLoc(),
+                            RuntimeSupport::Trace);
+    WriteBackInfo->Body += "_ORCHARD_TRACE_VISIT(\"" + idName +
+                           "\", truncate_flags, depth <= " +
+                           to_string(opts::TraceDepth) + ")\n";
+  }
   WriteBackInfo->Body += VisitsCounting;
 
   ////WriteBackInfo -> Body += "std::cout << 123 << std::endl;" ;
 
   WriteBackInfo->Body += RootCasting;
 
+  string ShortCircuitCheck =
+      getShortCircuitEntryCheck(TraversalsDeclarationsList);
+  if (ShortCircuitCheck != "")
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            ParticipatingCalls[0]->getBeginLoc(),
+                            RuntimeSupport::ShortCircuit);
+  WriteBackInfo->Body += ShortCircuitCheck;
+
+  string Prefetches = getChildPrefetches(TopologicalOrder, HasCXXCall);
+  WriteBackInfo->Body += Prefetches;
+
   unordered_map<int, vector<DG_Node *>> StamentsOderedByTId;
 
   // Topological sort for generating the parallel schedule
@@ -924,6 +2250,15 @@ void TraversalSynthesizer::generateWriteBackInfo(
   int i = 0;
   int vec_size = 0;
   bool tellParr = false;
+  size_t SpineBegin = string::npos, SpineEnd = string::npos;
+
+  // Calls of traversals that could not be fused run as one chain per child,
+  // the chains run in parallel
+  int FirstCallLevel, LastCallLevel;
+  std::vector<std::vector<DG_Node *>> PipelineChains;
+  if (opts::PipelineUnfused)
+    PipelineChains =
+        findPipelineChains(TopologicalOrder, FirstCallLevel, LastCallLevel);
 
   for (auto vecNode : TopologicalOrder) {
 
@@ -931,14 +2266,53 @@ void TraversalSynthesizer::generateWriteBackInfo(
     int j = 1;
     vec_size = 0;
 
+    if (PipelineChains.size() && i - 1 >= FirstCallLevel &&
+        i - 1 <= LastCallLevel) {
+      if (i - 1 != FirstCallLevel)
+        continue;
+      CurBlockId++;
+      string blockSubPart = "";
+      setBlockSubPart(/*Decls,*/ blockSubPart, TraversalsDeclarationsList,
+                      CurBlockId, StamentsOderedByTId, HasCXXCall);
+      WriteBackInfo->Body += blockSubPart;
+      StamentsOderedByTId.clear();
+
+      for (int Chain = 0; Chain < PipelineChains.size(); Chain++) {
+        string ChainName = "_orchard_chain" + to_string(Chain);
+        WriteBackInfo->Body += "/*Pipelined Calls " + to_string(Chain + 1) +
+                               "*/auto " + ChainName + " = [&]() {\n";
+        for (auto *CallNode : PipelineChains[Chain]) {
+          string CallPartText = "";
+          this->setCallPart(CallPartText, ParticipatingCalls,
+                            TraversalsDeclarationsList, CallNode,
+                            WriteBackInfo, HasCXXCall, 2);
+          WriteBackInfo->Body += CallPartText;
+        }
+        WriteBackInfo->Body += "};\n";
+        if (Chain + 1 < PipelineChains.size())
+          WriteBackInfo->Body += "if (depth < maxDepth) {\ncilk_spawn " +
+                                 ChainName + "();\n} else {\n" + ChainName +
+                                 "();\n}\n";
+        else
+          WriteBackInfo->Body += ChainName + "();\n";
+      }
+      if (PipelineChains.size() > 1)
+        WriteBackInfo->Body += "cilk_sync;\n";
+      flag = 1;
+      continue;
+    }
+
+    // count the units that run in parallel in this level
     for (auto *DG_Node : vecNode) {
 
-      if (DG_Node->getStatementInfo()->isCallStmt())
+      if (DG_Node->getStatementInfo()->isCallStmt() ||
+          DG_Node->getStatementInfo()->isHeavy())
         vec_size++;
     }
 
     for (auto *DG_Node : vecNode) {
-      if (!DG_Node->getStatementInfo()->isCallStmt()) {
+      if (!DG_Node->getStatementInfo()->isCallStmt() &&
+          !DG_Node->getStatementInfo()->isHeavy()) {
         flag = 0;
         StamentsOderedByTId[DG_Node->getTraversalId()].push_back(DG_Node);
         continue;
@@ -954,6 +2328,20 @@ void TraversalSynthesizer::generateWriteBackInfo(
         WriteBackInfo->Body += blockSubPart;
       }
 
+      if (DG_Node->getStatementInfo()->isHeavy()) {
+        // spawn the statement unless it is the last unit of the level
+        string HeavyStmtText = "";
+        setHeavyStmtPart(HeavyStmtText, TraversalsDeclarationsList, DG_Node,
+                         HasCXXCall, j < vec_size);
+        WriteBackInfo->Body += HeavyStmtText;
+        if (j < vec_size)
+          tellParr = true;
+        j++;
+        addSync = 1;
+        StamentsOderedByTId.clear();
+        continue;
+      }
+
       // Label the parallel calls...
       /*****************************************************************************************************************/
       std::string s = std::to_string(j);
@@ -981,8 +2369,23 @@ void TraversalSynthesizer::generateWriteBackInfo(
                         TraversalsDeclarationsList, DG_Node, WriteBackInfo,
                         HasCXXCall, isParallel);
 
+      // a chain of nodes of this type is gathered and visited by a parallel
+      // loop over the nodes instead
+      string SpineText =
+          SpineBegin == string::npos
+              ? createSpineCall(CallPartText, ParticipatingCalls,
+                                TopologicalOrder, DG_Node, WriteBackInfo,
+                                HasCXXCall, HasVirtual ? DerivedType : nullptr)
+              : "";
+      if (SpineText != "") {
+        SpineBegin = WriteBackInfo->Body.size();
+        CallPartText = SpineText;
+      }
+
       // collect call expression (only for participating traversals)
       WriteBackInfo->Body += CallPartText;
+      if (SpineText != "")
+        SpineEnd = WriteBackInfo->Body.size();
 
       // flag to make sure the sync part is added to the code
       addSync = 1;
@@ -1016,6 +2419,17 @@ void TraversalSynthesizer::generateWriteBackInfo(
   // callect call expression (only for participating traversals)
   WriteBackInfo->Body += CallPartText;
 
+  // The visit of a single node of a chain, used by the parallel loop
+  if (SpineBegin != string::npos) {
+    WriteBackInfo->SpineStepDeclaration =
+        StringReplace(WriteBackInfo->ForwardDeclaration, idName + "_parallel(",
+                      idName + "_spine_step(");
+    WriteBackInfo->Body += "};\n\n" + WriteBackInfo->SpineStepDeclaration +
+                           "{\n" + WriteBackInfo->Body.substr(0, SpineBegin) +
+                           "/*chain call elided*/\n" +
+                           WriteBackInfo->Body.substr(SpineEnd);
+  }
+
   WriteBackInfo->Body += "};\n\n";
 
   /*********************************************************************************************************************/
@@ -1029,6 +2443,10 @@ void TraversalSynthesizer::generateWriteBackInfo(
       getHighestCommonTraversedType(TraversalsDeclarationsList)
           ->getNameAsString() +
       "*" + " _r";
+  WriteBackInfo->SerialParameters.push_back(
+      getHighestCommonTraversedType(TraversalsDeclarationsList)
+          ->getNameAsString() +
+      "* _r");
 
   // append the arguments of each method and rename locals  by adding _fx_ only
   // participating traversals
@@ -1045,10 +2463,14 @@ void TraversalSynthesizer::generateWriteBackInfo(
       forward_declaration_serial +=
           "," + string(Param->getType().getAsString()) + " _f" +
           to_string(Idx) + "_" + Param->getDeclName().getAsString();
+      WriteBackInfo->SerialParameters.push_back(
+          string(Param->getType().getAsString()) + " _f" + to_string(Idx) +
+          "_" + Param->getDeclName().getAsString());
     }
   }
 
   forward_declaration_serial += ", unsigned int truncate_flags)";
+  WriteBackInfo->SerialParameters.push_back("unsigned int truncate_flags");
 
   /************************************************************************************************************************/
   // end forward declaration for serial code
@@ -1160,15 +2582,23 @@ void TraversalSynthesizer::generateWriteBackInfo(
     }
   }
 
-  VisitsCounting = "\n#ifdef COUNT_VISITS \n _VISIT_COUNTER++;\n #endif \n";
+  VisitsCounting = getVisitCounting(idName + "_serial", VisitedTypeName, true);
 
+  size_t SerialBodyBegin = WriteBackInfo->Body.size();
   WriteBackInfo->Body += VisitsCounting;
   WriteBackInfo->Body += RootCasting;
+  WriteBackInfo->Body += ShortCircuitCheck;
+  WriteBackInfo->Body += Prefetches;
 
   // clear the statements in the vector, we are about to generate code for all
   // the serial part
   StamentsOderedByTId.clear();
 
+  // The blocks and the calls of the serial body in order, used by
+  // -iterative-serial
+  std::vector<std::pair<bool, std::string>> SerialSegments;
+  bool HasDeclarations = false;
+
   CurBlockId = 0;
   flag = 0;
   addSync = 0;
@@ -1179,6 +2609,9 @@ void TraversalSynthesizer::generateWriteBackInfo(
       if (!DG_Node->getStatementInfo()->isCallStmt()) {
         flag = 0;
         StamentsOderedByTId[DG_Node->getTraversalId()].push_back(DG_Node);
+        if (DG_Node->getStatementInfo()->Stmt->getStmtClass() ==
+            clang::Stmt::DeclStmtClass)
+          HasDeclarations = true;
         continue;
       }
       // ecnounter a statement
@@ -1191,6 +2624,7 @@ void TraversalSynthesizer::generateWriteBackInfo(
         setBlockSubPart(/*Decls,*/ blockSubPart, TraversalsDeclarationsList,
                         CurBlockId, StamentsOderedByTId, HasCXXCall);
         WriteBackInfo->Body += blockSubPart;
+        SerialSegments.push_back(std::make_pair(false, blockSubPart));
       }
 
       WriteBackInfo->Body += "/*Serial Call*/";
@@ -1203,6 +2637,7 @@ void TraversalSynthesizer::generateWriteBackInfo(
                         HasCXXCall, 3);
       // collect call expression (only for participating traversals)
       WriteBackInfo->Body += CallPartText;
+      SerialSegments.push_back(std::make_pair(true, CallPartText));
       addSync = 1;
 
       StamentsOderedByTId.clear();
@@ -1223,12 +2658,64 @@ void TraversalSynthesizer::generateWriteBackInfo(
                         CurBlockId, StamentsOderedByTId, HasCXXCall);
 
   WriteBackInfo->Body += blockSubPart;
+  SerialSegments.push_back(std::make_pair(false, blockSubPart));
 
   CallPartText = "return ;\n";
   // callect call expression (only for participating traversals)
   WriteBackInfo->Body += CallPartText;
   WriteBackInfo->Body = /* Decls + */ WriteBackInfo->Body;
 
+  if (opts::FrontierMode) {
+    // Traversals are visited level by level when the calls of a node run in
+    // parallel with each other, and nothing skips them or leaves state behind
+    // for the statements that follow them
+    bool FrontierEligible = !HasDeclarations && ShortCircuitCheck == "";
+    int CallLevels = 0;
+    for (auto &Level : TopologicalOrder) {
+      bool HasCall = false;
+      for (auto *Node : Level) {
+        if (Node->getStatementInfo()->hasReturn())
+          FrontierEligible = false;
+        if (Node->getStatementInfo()->isCallStmt())
+          HasCall = true;
+      }
+      CallLevels += HasCall;
+    }
+    if (CallLevels > 1)
+      FrontierEligible = false;
+    for (auto *Decl : TraversalsDeclarationsList)
+      for (auto *Param : Decl->parameters())
+        if (Param->getType()->isReferenceType() ||
+            !Param->getType().isTriviallyCopyableType(*ASTCtx))
+          FrontierEligible = false;
+
+    WriteBackInfo->FrontierFunctions = createFrontierFunctions(
+        WriteBackInfo, SerialSegments,
+        getVisitCounting(idName + "_frontier", VisitedTypeName, false),
+        RootCasting,
+        FrontierEligible);
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            ParticipatingCalls[0]->getBeginLoc(),
+                            RuntimeSupport::Frontier);
+  }
+
+  if (opts::IterativeSerial && !HasVirtual && !HasDeclarations) {
+    string IterativeBody =
+        createIterativeSerialBody(WriteBackInfo, SerialSegments,
+                                  TraversalsDeclarationsList, HasCXXCall,
+                                  getVisitCounting(idName + "_serial",
+                                                   VisitedTypeName, false) +
+                                      ShortCircuitCheck + Prefetches);
+    if (IterativeBody != "") {
+      RuntimeSupport::require(ASTCtx->getSourceManager(),
+                              ParticipatingCalls[0]->getBeginLoc(),
+                              RuntimeSupport::ExplicitStack);
+      WriteBackInfo->Body.resize(SerialBodyBegin);
+      WriteBackInfo->Body += IterativeBody;
+    }
+  }
+  WriteBackInfo->SerialBody = WriteBackInfo->Body.substr(SerialBodyBegin);
+
   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
   ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////Till
   ///here
@@ -1428,129 +2915,57 @@ Trying to make a seperate write back info code for non parallel code.
 
 extern AccessPath extractVisitedChild(clang::CallExpr *Call);
 
-void TraversalSynthesizer::WriteUpdates(
-    const std::vector<clang::CallExpr *> CallsExpressions,
-    clang::FunctionDecl *EnclosingFunctionDecl) {
-
-  for (auto *CallExpr : CallsExpressions)
-    Rewriter.InsertText(CallExpr->getBeginLoc(), "//");
-
-  // add forward declarations
-  for (auto &SynthesizedFunction : SynthesizedFunctions) {
-    Rewriter.InsertText(
-        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
-        (SynthesizedFunction.second->ForwardDeclaration) + string(";\n"));
-  }
-
-  for (auto &SynthesizedFunction : SynthesizedFunctions) {
-    Rewriter.InsertText(
-        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
-        (SynthesizedFunction.second->ForwardDeclaration_serial) +
-            string(";\n"));
-  }
-
-  static std::set<string> InsertedFunctions;
-
-  for (auto &SynthesizedFunction : SynthesizedFunctions) {
-    if(InsertedFunctions.count(SynthesizedFunction.second->FunctionName))
-    continue;
-    else 
-    InsertedFunctions.insert(SynthesizedFunction.second->FunctionName);
-    Rewriter.InsertText(
-        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
-        (SynthesizedFunction.second->ForwardDeclaration + "\n{\n" +
-         SynthesizedFunction.second->Body + "\n};\n"));
-  }
-
-  for (auto &SynthesizedFunction : SynthesizedFunctions) {
-    if (InsertedFunctions.count(SynthesizedFunction.second->FunctionName))
-      continue;
-    else
-      InsertedFunctions.insert(SynthesizedFunction.second->FunctionName);
-    Rewriter.InsertText(
-        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
-        (SynthesizedFunction.second->ForwardDeclaration_serial + "\n{\n" +
-         SynthesizedFunction.second->Body + "\n};\n"));
-  }
-
+std::string TraversalSynthesizer::createTopLevelCall(
+    const std::vector<clang::CallExpr *> &CallsExpressions,
+    const std::string &Suffix, const std::string &ExtraArguments) {
   StatementPrinter Printer;
-  // 2-build the new function call and add It.
-  bool IsMemberCall = CallsExpressions[0]->getStmtClass() ==
-                      clang::Stmt::CXXMemberCallExprClass;
 
   bool HasVirtual = false;
-  bool HasCXXMethod = false;
-
   for (auto *Call : CallsExpressions) {
     auto *CalleeInfo = FunctionsFinder::getFunctionInfo(
         Call->getCalleeDecl()->getAsFunction()->getDefinition());
-    if (CalleeInfo->isCXXMember())
-      HasCXXMethod = true;
     if (CalleeInfo->isVirtual())
       HasVirtual = true;
   }
+
   std::string NextCallName;
   if (!HasVirtual)
     NextCallName = createName(CallsExpressions, false, nullptr);
-  else
+  else if (opts::ClosedHierarchy &&
+           hasTypeTags(getCalledChildType(CallsExpressions))) {
+    NextCallName = getTagDispatcher(CallsExpressions);
+    HasVirtual = false;
+  } else
     NextCallName = getVirtualStub(CallsExpressions);
 
   string NewCall = "";
-
-  NewCall += "\n\tint startDepth = 0;\n\t";
-
-  NewCall += "\n\tint maximumDepth = 1024;\n\t";
-
-  NewCall += "\n\tif (startDepth < maximumDepth)";
-  NewCall += " {";
-  NewCall += "\n";
-
   string Params = "";
 
-  if (!HasVirtual) {
-    NewCall += NextCallName + "_parallel" + "(";
-
-    if (CallsExpressions[0]->getStmtClass() == clang::Stmt::CallExprClass) {
-      auto FirstArgument =
-          dyn_cast<clang::CallExpr>(CallsExpressions[0])->getArg(0);
-      Params += Printer.printStmt(FirstArgument, ASTCtx->getSourceManager(),
-                                  nullptr, "", -1);
-    } else if (CallsExpressions[0]->getStmtClass() ==
-               clang::Stmt::CXXMemberCallExprClass) {
-      Params += Printer.printStmt(
-          CallsExpressions[0]->child_begin()->child_begin()->IgnoreImplicit(),
-          ASTCtx->getSourceManager(), nullptr, "", -1, false);
-    }
-
-  } else {
-    if (CallsExpressions[0]->getStmtClass() ==
-        clang::Stmt::CXXMemberCallExprClass) {
-      NewCall += Printer.printStmt(CallsExpressions[0]
-                                       ->child_begin()
-                                       ->child_begin()
-                                       ->IgnoreImplicit(),
-                                   ASTCtx->getSourceManager(), nullptr, "", -1,
-                                   false) +
-                 "->" + NextCallName + "_parallel" + "(";
-    } else if (CallsExpressions[0]->getStmtClass() ==
-               clang::Stmt::CallExprClass) {
-
-      auto FirstArgument =
-          dyn_cast<clang::CallExpr>(CallsExpressions[0])->getArg(0);
-
-      NewCall += NextCallName + "(";
-      Params += Printer.printStmt(FirstArgument, ASTCtx->getSourceManager(),
-                                  nullptr, "", -1);
+  if (CallsExpressions[0]->getStmtClass() == clang::Stmt::CallExprClass) {
+    auto FirstArgument =
+        dyn_cast<clang::CallExpr>(CallsExpressions[0])->getArg(0);
+    NewCall += NextCallName + Suffix + "(";
+    Params += Printer.printStmt(FirstArgument, ASTCtx->getSourceManager(),
+                                nullptr, "", -1);
+  } else if (CallsExpressions[0]->getStmtClass() ==
+             clang::Stmt::CXXMemberCallExprClass) {
+    auto *CalledChild =
+        CallsExpressions[0]->child_begin()->child_begin()->IgnoreImplicit();
+    if (!HasVirtual) {
+      NewCall += NextCallName + Suffix + "(";
+      Params += Printer.printStmt(CalledChild, ASTCtx->getSourceManager(),
+                                  nullptr, "", -1, false);
     } else {
-      llvm_unreachable("unexpected");
+      NewCall += Printer.printStmt(CalledChild, ASTCtx->getSourceManager(),
+                                   nullptr, "", -1, false) +
+                 "->" + NextCallName + Suffix + "(";
     }
+  } else {
+    llvm_unreachable("unexpected");
   }
 
-  // 3-append arguments of all methods in the same oƒrder and build default
-  // params
-  // hack
+  // append arguments of all methods in the same order
   for (auto *CallExpr : CallsExpressions) {
-
     for (int ArgIdx =
              CallExpr->getCalleeDecl()->getAsFunction()->isGlobal() ? 1 : 0;
          ArgIdx < CallExpr->getNumArgs(); ArgIdx++) {
@@ -1565,92 +2980,653 @@ void TraversalSynthesizer::WriteUpdates(
   for (int i = 0; i < CallsExpressions.size(); i++)
     x |= (1 << i);
 
-  // added ", 0, 1024" here to control the depth part 0 means starting depth and
-  // 1024 is max depth
+  Params +=
+      ((Params.size() == 0) ? "" : ", ") + toBinaryString(x) + ExtraArguments;
+
+  return NewCall + Params + ");";
+}
 
-  Params += ((Params.size() == 0) ? "" : ", ") + toBinaryString(x) +
-            ", startDepth, maximumDepth" + ");";
-  /**********************************************************************************************/
+std::string TraversalSynthesizer::createIterativeSerialBody(
+    FusedTraversalWritebackInfo *WriteBackInfo,
+    const std::vector<std::pair<bool, std::string>> &Segments,
+    const std::vector<clang::FunctionDecl *> &TraversalsDeclarationsList,
+    bool HasCXXCall, const std::string &Prologue) {
+  static const string Marker = "/*@orchard_unroll ";
+
+  std::vector<string> ParameterNames;
+  for (auto &Parameter : WriteBackInfo->SerialParameters)
+    ParameterNames.push_back(Parameter.substr(Parameter.rfind(' ') + 1));
+
+  // The last call can reuse the frame of its caller when nothing follows it
+  int LastCall = -1;
+  for (int i = 0; i < Segments.size(); i++)
+    if (Segments[i].first)
+      LastCall = i;
+  bool HasTailCall = LastCall != -1;
+  for (int i = LastCall + 1; HasTailCall && i < Segments.size(); i++)
+    HasTailCall = Segments[i].second.find_first_not_of(" \t\n") == string::npos;
+
+  string Cases = "";
+  for (int i = 0; i < Segments.size(); i++) {
+    string Segment = Segments[i].second;
+
+    // every call must be a call to this very function
+    if (Segments[i].first && Segment.find(Marker) != string::npos) {
+      size_t MarkerBegin = Segment.find(Marker);
+      size_t MarkerEnd = Segment.find("@*/", MarkerBegin);
+      if (Segment.find(Marker, MarkerEnd) != string::npos)
+        return "";
+      auto &Site = UnrollSites[stoi(
+          Segment.substr(MarkerBegin + Marker.size(),
+                         MarkerEnd - MarkerBegin - Marker.size()))];
+      if (Site.CalleeName != WriteBackInfo->FunctionName ||
+          Site.Arguments.size() != ParameterNames.size())
+        return "";
+
+      // save the current visit unless this is the tail call, then continue
+      // with the child
+      string Push = "{\n";
+      for (int j = 0; j < Site.Arguments.size(); j++)
+        Push += "auto _orchard_a" + to_string(j) + " = (" + Site.Arguments[j] +
+                ");\n";
+      if (!(HasTailCall && i == LastCall)) {
+        Push += "_orchard_stack.push_back(_orchard_frame{";
+        for (auto &Name : ParameterNames)
+          Push += Name + ", ";
+        Push += to_string(i + 1) + "});\n";
+      }
+      for (int j = 0; j < ParameterNames.size(); j++)
+        Push += ParameterNames[j] + " = _orchard_a" + to_string(j) + ";\n";
+      Push += "_orchard_resume = 0;\ngoto _orchard_dispatch;\n}\n";
+
+      Segment = Segment.substr(0, MarkerBegin) + Push +
+                Segment.substr(MarkerEnd + 3);
+    } else if (Segments[i].first &&
+               Segment.find("empty call elided") == string::npos) {
+      return "";
+    }
+
+    Cases += "case " + to_string(i) + ": {\n" +
+             (i == 0 ? Prologue : string("")) + Segment + ";\n}\n";
+  }
 
-  NewCall += Params;
-  NewCall += "\n\t}";
-  NewCall += "\n\telse{\n\t";
+  string RootDeclarations = "", RootCasting = "";
+  if (HasCXXCall) {
+    for (int i = 0; i < TraversalsDeclarationsList.size(); i++) {
+      auto *Decl = TraversalsDeclarationsList[i];
+      CXXRecordDecl *CastedToType = nullptr;
 
-  // add a call for the serial part also
-  Params = "";
-  if (!HasVirtual) {
-    NewCall += NextCallName + "_serial" + "(";
+      if (FunctionsFinder::getFunctionInfo(Decl)->isGlobal())
+        CastedToType = Decl->getParamDecl(0)->getType()->getAsCXXRecordDecl();
+      else
+        CastedToType = dyn_cast<clang::CXXMethodDecl>(Decl)->getParent();
 
-    if (CallsExpressions[0]->getStmtClass() == clang::Stmt::CallExprClass) {
-      auto FirstArgument =
-          dyn_cast<clang::CallExpr>(CallsExpressions[0])->getArg(0);
-      Params += Printer.printStmt(FirstArgument, ASTCtx->getSourceManager(),
-                                  nullptr, "", -1);
-    } else if (CallsExpressions[0]->getStmtClass() ==
-               clang::Stmt::CXXMemberCallExprClass) {
-      Params += Printer.printStmt(
-          CallsExpressions[0]->child_begin()->child_begin()->IgnoreImplicit(),
-          ASTCtx->getSourceManager(), nullptr, "", -1, false);
+      RootDeclarations += CastedToType->getNameAsString() + " *_r_f" +
+                          to_string(i) + ";\n";
+      RootCasting += "_r_f" + to_string(i) + " = (" +
+                     CastedToType->getNameAsString() + "*)(_r);\n";
     }
+  }
 
-  } else {
-    if (CallsExpressions[0]->getStmtClass() ==
-        clang::Stmt::CXXMemberCallExprClass) {
-      NewCall += Printer.printStmt(CallsExpressions[0]
-                                       ->child_begin()
-                                       ->child_begin()
-                                       ->IgnoreImplicit(),
-                                   ASTCtx->getSourceManager(), nullptr, "", -1,
-                                   false) +
-                 "->" + NextCallName + "_serial" + "(";
-    } else if (CallsExpressions[0]->getStmtClass() ==
-               clang::Stmt::CallExprClass) {
-
-      auto FirstArgument =
-          dyn_cast<clang::CallExpr>(CallsExpressions[0])->getArg(0);
-
-      NewCall += NextCallName + "(";
-      Params += Printer.printStmt(FirstArgument, ASTCtx->getSourceManager(),
-                                  nullptr, "", -1);
-    } else {
-      llvm_unreachable("unexpected");
+  string Body = "struct _orchard_frame {\n";
+  for (auto &Parameter : WriteBackInfo->SerialParameters)
+    Body += Parameter + ";\n";
+  Body += "int _orchard_resume;\n};\n";
+  Body += "std::vector<_orchard_frame> _orchard_stack;\n";
+  Body += "int _orchard_resume = 0;\n";
+  Body += RootDeclarations;
+  Body += "_orchard_dispatch:\n";
+  Body += RootCasting;
+  Body += "switch (_orchard_resume) {\n" + Cases + "}\n";
+
+  // the visit is over, resume its caller
+  Body += "if (_orchard_stack.empty())\nreturn ;\n";
+  for (auto &Name : ParameterNames)
+    Body += Name + " = _orchard_stack.back()." + Name + ";\n";
+  Body += "_orchard_resume = _orchard_stack.back()._orchard_resume;\n";
+  Body += "_orchard_stack.pop_back();\ngoto _orchard_dispatch;\n";
+  return Body;
+}
+
+std::string TraversalSynthesizer::createFrontierFunctions(
+    FusedTraversalWritebackInfo *WriteBackInfo,
+    const std::vector<std::pair<bool, std::string>> &Segments,
+    const std::string &Prologue, const std::string &RootCasting,
+    bool Eligible) {
+  string Name = WriteBackInfo->FunctionName;
+  string ArgsType = Name + "_frontier_args";
+
+  string Parameters = "", Arguments = "", Unpacking = "";
+  for (auto &Parameter : WriteBackInfo->SerialParameters) {
+    string ParameterName = Parameter.substr(Parameter.rfind(' ') + 1);
+    Parameters += (Parameters == "" ? "" : ", ") + Parameter;
+    Arguments += (Arguments == "" ? "" : ", ") + ParameterName;
+    Unpacking += Parameter + " = ((" + ArgsType + " *)_orchard_args)->" +
+                 ParameterName + ";\n";
+  }
+  WriteBackInfo->FrontierDeclaration =
+      "void " + Name + "_frontier(" + Parameters + ")";
+
+  // The calls must follow the statements that run top down and precede the
+  // statements that run bottom up
+  int FirstCall = -1, LastCall = -1;
+  for (int i = 0; i < Segments.size(); i++) {
+    if (!Segments[i].first)
+      continue;
+    if (FirstCall == -1)
+      FirstCall = i;
+    LastCall = i;
+  }
+  for (int i = FirstCall + 1; Eligible && i < LastCall; i++)
+    if (!Segments[i].first &&
+        Segments[i].second.find_first_not_of(" \t\n") != string::npos)
+      Eligible = false;
+
+  // anything else is visited at once, serially
+  if (!Eligible)
+    return WriteBackInfo->FrontierDeclaration + "{\n" + Name + "_serial(" +
+           Arguments + ");\n}\n\n";
+
+  string TopDown = "", BottomUp = "";
+  for (int i = 0; i < Segments.size(); i++) {
+    if (LastCall != -1 && i > LastCall) {
+      BottomUp += Segments[i].second;
+      continue;
     }
+    if (!Segments[i].first) {
+      TopDown += Segments[i].second;
+      continue;
+    }
+    // the children are pushed to the next level instead of being called
+    string Call = expandUnrolledCalls(Segments[i].second, opts::UnrollDepth);
+    for (size_t Pos = Call.find("_serial("); Pos != string::npos;
+         Pos = Call.find("_serial(", Pos))
+      Call.replace(Pos, 8, "_frontier(");
+    TopDown += Call;
+  }
+  bool HasBottomUp = BottomUp.find_first_not_of(" \t\n") != string::npos;
+
+  string Text = "struct " + ArgsType + " {\n";
+  for (auto &Parameter : WriteBackInfo->SerialParameters)
+    Text += Parameter + ";\n";
+  Text += "};\n\n";
+
+  Text += "void " + Name + "_frontier_visit(void *_orchard_args) {\n" +
+          Unpacking + Prologue + RootCasting + TopDown + "}\n\n";
+  if (HasBottomUp)
+    Text += "void " + Name + "_frontier_finish(void *_orchard_args) {\n" +
+            Unpacking + RootCasting + BottomUp + "}\n\n";
+
+  Text += WriteBackInfo->FrontierDeclaration + "{\n_orchard_frontier_push(" +
+          Name + "_frontier_visit, " +
+          (HasBottomUp ? Name + "_frontier_finish" : string("nullptr")) +
+          ", " + ArgsType + "{" + Arguments + "});\n}\n\n";
+  WriteBackInfo->FrontierEligible = true;
+  return Text;
+}
+
+bool TraversalSynthesizer::isFrontierCall(
+    const std::vector<clang::CallExpr *> &CallsExpressions) {
+  if (!opts::FrontierMode)
+    return false;
+
+  bool HasVirtual = false;
+  for (auto *Call : CallsExpressions)
+    if (FunctionsFinder::getFunctionInfo(
+            Call->getCalleeDecl()->getAsFunction()->getDefinition())
+            ->isVirtual())
+      HasVirtual = true;
+
+  std::vector<string> Names;
+  if (!HasVirtual)
+    Names.push_back(createName(CallsExpressions, false, nullptr));
+  else {
+    auto *ChildType = getCalledChildType(CallsExpressions);
+    Names.push_back(createName(CallsExpressions, true, ChildType));
+    for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[ChildType])
+      Names.push_back(createName(CallsExpressions, true, DerivedType));
   }
 
-  // 3-append arguments of all methods in the same oƒrder and build default
-  // params
-  // hack
-  for (auto *CallExpr : CallsExpressions) {
+  for (auto &Name : Names)
+    if (SynthesizedFunctions.count(Name) &&
+        !SynthesizedFunctions[Name]->FrontierEligible)
+      return false;
+  return true;
+}
 
-    for (int ArgIdx =
-             CallExpr->getCalleeDecl()->getAsFunction()->isGlobal() ? 1 : 0;
-         ArgIdx < CallExpr->getNumArgs(); ArgIdx++) {
-      Params += ((Params.size() == 0) ? "" : ", ") +
-                Printer.stmtTostr(CallExpr->getArg(ArgIdx),
-                                  ASTCtx->getSourceManager());
+std::string TraversalSynthesizer::createSpineCall(
+    const std::string &CallPartText,
+    const std::vector<clang::CallExpr *> &ParticipatingCalls,
+    const std::vector<vector<DG_Node *>> &TopologicalOrder, DG_Node *CallNode,
+    FusedTraversalWritebackInfo *WriteBackInfo, bool HasCXXCall,
+    const CXXRecordDecl *DerivedType) {
+  if (!opts::ChunkSpines || !DerivedType)
+    return "";
+
+  std::vector<DG_Node *> NextCallNodes;
+  if (CallNode->isMerged())
+    NextCallNodes = CallNode->getMergeInfo()->getCallsOrdered();
+  else
+    NextCallNodes.push_back(CallNode);
+
+  // every traversal must follow the chain, in the same order, so that the
+  // truncate flags of the next node of the chain are the current ones
+  if (NextCallNodes.size() != ParticipatingCalls.size())
+    return "";
+  std::vector<clang::CallExpr *> NexTCallExpressions;
+  for (int i = 0; i < NextCallNodes.size(); i++) {
+    if (NextCallNodes[i]->getTraversalId() != i)
+      return "";
+    auto *Call = dyn_cast<clang::CXXMemberCallExpr>(
+        NextCallNodes[i]->getStatementInfo()->Stmt);
+    if (!Call || !FunctionsFinder::getFunctionInfo(
+                      Call->getCalleeDecl()->getAsFunction()->getDefinition())
+                      ->isVirtual())
+      return "";
+    NexTCallExpressions.push_back(Call);
+  }
+
+  // the chain continues while the next node runs this very function
+  if (createName(NexTCallExpressions, true, DerivedType) !=
+      WriteBackInfo->FunctionName)
+    return "";
+
+  // the child is a field of the visited node
+  auto *ChildExpr = dyn_cast<clang::MemberExpr>(
+      NexTCallExpressions[0]->getImplicitObjectArgument()->IgnoreImplicit());
+  if (!ChildExpr ||
+      !isa<clang::CXXThisExpr>(ChildExpr->getBase()->IgnoreImplicit()) ||
+      !isa<clang::FieldDecl>(ChildExpr->getMemberDecl()))
+    return "";
+  for (auto *Call : NexTCallExpressions) {
+    auto *OtherChild = dyn_cast<clang::MemberExpr>(
+        dyn_cast<clang::CXXMemberCallExpr>(Call)
+            ->getImplicitObjectArgument()
+            ->IgnoreImplicit());
+    if (!OtherChild ||
+        OtherChild->getMemberDecl() != ChildExpr->getMemberDecl())
+      return "";
+  }
+
+  // the nodes of the chain are visited with the arguments of the first one
+  string Arguments = "";
+  for (int i = 0; i < NexTCallExpressions.size(); i++) {
+    auto *Call = NexTCallExpressions[i];
+    for (int ArgIdx = 0; ArgIdx < Call->getNumArgs(); ArgIdx++) {
+      auto *Arg =
+          dyn_cast<clang::DeclRefExpr>(Call->getArg(ArgIdx)->IgnoreImpCasts());
+      auto *Param =
+          Arg ? dyn_cast<clang::ParmVarDecl>(Arg->getDecl()) : nullptr;
+      if (!Param || Param->getFunctionScopeIndex() != ArgIdx)
+        return "";
+      Arguments += ", _f" + to_string(i) + "_" + Param->getNameAsString();
     }
   }
 
-  // add initial truncate flags
-  x = 0;
-  for (int i = 0; i < CallsExpressions.size(); i++)
-    x |= (1 << i);
+  // the rest of the body must neither depend on the chain nor be skipped by
+  // a return
+  for (auto *Node : NextCallNodes) {
+    auto IsPeer = [&](DG_Node *Other) {
+      return Other == Node ||
+             find(NextCallNodes.begin(), NextCallNodes.end(), Other) !=
+                 NextCallNodes.end();
+    };
+    for (auto &Entry : Node->getSuccessors())
+      if (!IsPeer(Entry.first))
+        return "";
+    for (auto &Entry : Node->getPredecessors())
+      if (!IsPeer(Entry.first))
+        return "";
+  }
+  for (auto &Level : TopologicalOrder)
+    for (auto *Node : Level)
+      if (Node->getStatementInfo()->hasReturn())
+        return "";
 
-  // added ", 0, 1024" here to control the depth part 0 means starting depth and
-  // 1024 is max depth
+  StatementPrinter Printer;
+  string ChildText = Printer.printStmt(CallNode->getStatementInfo()
+                                          ->Stmt->child_begin()
+                                          ->child_begin()
+                                          ->IgnoreImplicit(),
+                                      ASTCtx->getSourceManager(), nullptr, "",
+                                      CallNode->getTraversalId(), HasCXXCall,
+                                      HasCXXCall);
+  string TypeName = DerivedType->getNameAsString();
+  string Next = "_orchard_spine_end";
+  string IsChainNode =
+      opts::ClosedHierarchy && hasTypeTags(DerivedType)
+          ? Next + "->_orchard_tag == " + to_string(getTypeTag(DerivedType))
+          : "typeid(*" + Next + ") == typeid(" + TypeName + ")";
+  string ChunkSize = to_string(std::max(1u, (unsigned)opts::SpineChunkSize));
+
+  // The end of the chain is visited by the original call
+  string EndCall = CallPartText;
+  for (size_t Pos = EndCall.find(ChildText); Pos != string::npos;
+       Pos = EndCall.find(ChildText, Pos + Next.size()))
+    EndCall.replace(Pos, ChildText.size(), Next);
+
+  RuntimeSupport::require(ASTCtx->getSourceManager(),
+                          ParticipatingCalls[0]->getBeginLoc(),
+                          RuntimeSupport::SpineChunking);
+
+  string Text = "if (truncate_flags) {\n";
+  Text += "std::vector<" + TypeName + " *> _orchard_spine;\n";
+  Text += "auto *" + Next + " = " + ChildText + ";\n";
+  Text += "while (" + Next + " && " + IsChainNode + ") {\n";
+  Text += "_orchard_spine.push_back((" + TypeName + " *)" + Next + ");\n";
+  Text += Next + " = ((" + TypeName + " *)" + Next + ")->" +
+          ChildExpr->getMemberDecl()->getNameAsString() + ";\n}\n";
+  Text += "cilk_for (long _orchard_chunk = 0; _orchard_chunk < "
+          "(long)_orchard_spine.size(); _orchard_chunk += " +
+          ChunkSize + ") {\n";
+  // each chunk is a spawned strand of the work/span instrumentation
+  if (opts::WorkSpan)
+    Text += "_ORCHARD_FOR_ITERATION\n";
+  Text += "for (long _orchard_i = _orchard_chunk; _orchard_i < "
+          "(long)_orchard_spine.size() && _orchard_i < _orchard_chunk + " +
+          ChunkSize + "; _orchard_i++)\n";
+  Text += WriteBackInfo->FunctionName +
+          "_spine_step(_orchard_spine[_orchard_i]" + Arguments +
+          ", truncate_flags, depth + 1, maxDepth);\n}\n";
+  if (opts::WorkSpan)
+    Text += "_ORCHARD_FOR_END\n";
+  Text += EndCall + "\n}\n";
+  return Text;
+}
 
-  Params += ((Params.size() == 0) ? "" : ", ") + toBinaryString(x) + ");";
-  /**********************************************************************************************/
+std::string TraversalSynthesizer::expandUnrolledCalls(const std::string &Text,
+                                                      unsigned Depth) {
+  static const string Marker = "/*@orchard_unroll ";
+  static int InlinedCount = 0;
+
+  string Output = "";
+  size_t Position = 0;
+  while (true) {
+    size_t MarkerBegin = Text.find(Marker, Position);
+    if (MarkerBegin == string::npos)
+      break;
+    size_t MarkerEnd = Text.find("@*/", MarkerBegin);
+    Output += Text.substr(Position, MarkerBegin - Position);
+    Position = MarkerEnd + 3;
+
+    auto &Site = UnrollSites[stoi(
+        Text.substr(MarkerBegin + Marker.size(),
+                    MarkerEnd - MarkerBegin - Marker.size()))];
+
+    // Inline the serial body of the callee, unless it is too deep, too large
+    // or it cannot be inlined
+    FusedTraversalWritebackInfo *Callee =
+        SynthesizedFunctions.count(Site.CalleeName)
+            ? SynthesizedFunctions[Site.CalleeName]
+            : nullptr;
+    string Body = Callee ? Callee->SerialBody : "";
+    const string FinalReturn = "return ;\n";
+    if (Body.size() >= FinalReturn.size() &&
+        Body.compare(Body.size() - FinalReturn.size(), FinalReturn.size(),
+                     FinalReturn) == 0)
+      Body.resize(Body.size() - FinalReturn.size());
+    else
+      Body = "";
 
-  NewCall += Params;
-  NewCall += "\n\t}";
+    if (Depth >= opts::UnrollDepth || Body == "" ||
+        (unsigned)count(Body.begin(), Body.end(), ';') > opts::UnrollMaxSize ||
+        Site.Arguments.size() != Callee->SerialParameters.size()) {
+      Output += Site.CallText;
+      continue;
+    }
 
-  Rewriter.InsertTextAfter(
-      Lexer::findLocationAfterToken(
-          CallsExpressions[CallsExpressions.size() - 1]->getEndLoc(),
-          tok::TokenKind::semi, ASTCtx->getSourceManager(),
-          ASTCtx->getLangOpts(), true),
-      "\n\t//added by fuse transformer \n\t" + NewCall + "\n");
+    // The arguments are evaluated before the parameters shadow the names of
+    // the caller. The early returns of the callee are gotos to the exit labels
+    // of its blocks, every label and goto is renamed to stay unique within
+    // the function
+    string Id = to_string(InlinedCount++);
+    Body = StringReplaceAll(expandUnrolledCalls(Body, Depth + 1), "_label_",
+                            "_label_U" + Id + "_");
+
+    Output += "{/*inlined " + Site.CalleeName + "*/\n";
+    for (int i = 0; i < Site.Arguments.size(); i++)
+      Output += "auto _orchard_u" + Id + "_a" + to_string(i) + " = (" +
+                Site.Arguments[i] + ");\n";
+    Output += "{\n";
+    for (int i = 0; i < Site.Arguments.size(); i++)
+      Output += Callee->SerialParameters[i] + " = _orchard_u" + Id + "_a" +
+                to_string(i) + ";\n";
+    // the body may end with the exit label of its last block
+    Output += Body + ";\n}\n}\n";
+  }
+  Output += Text.substr(Position);
+  return Output;
+}
+
+std::string TraversalSynthesizer::getTagDispatcher(
+    const std::vector<clang::CallExpr *> &Calls) {
+  return getCalledChildType(Calls)->getNameAsString() +
+         "::" + getVirtualStub(Calls) + "_dispatch";
+}
+
+void TraversalSynthesizer::insertTypeTags(const CXXRecordDecl *Record) {
+  static std::set<const CXXRecordDecl *> TaggedRecords;
+
+  // The tag is stored in the root of the hierarchy, and the constructors of
+  // each derived class overwrite it at the start of their body, which runs
+  // after the constructors of its bases. Copies keep the tag of their source
+  auto *Root = getHierarchyRoot(Record);
+  if (TaggedRecords.count(Root) || !hasTypeTags(Root))
+    return;
+  TaggedRecords.insert(Root);
+
+  Rewriter.InsertText(Root->getDefinition()->getEndLoc(),
+                      "public: unsigned int _orchard_tag = " +
+                          to_string(getTypeTag(Root)) + ";\n");
+  for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[Root]) {
+    if (TaggedRecords.count(DerivedType))
+      continue;
+    TaggedRecords.insert(DerivedType);
+    string SetTag = "_orchard_tag = " + to_string(getTypeTag(DerivedType)) +
+                    ";";
+    auto *Definition = DerivedType->getDefinition();
+
+    if (!Definition->hasUserDeclaredConstructor()) {
+      Rewriter.InsertText(Definition->getEndLoc(),
+                          "public: " + Definition->getNameAsString() +
+                              "() { " + SetTag + " }\n");
+      continue;
+    }
+    for (auto *Ctor : Definition->ctors()) {
+      if (Ctor->isImplicit() || Ctor->isDeleted() ||
+          Ctor->isCopyOrMoveConstructor())
+        continue;
+      // "= default" becomes a body that sets the tag
+      if (Ctor->isExplicitlyDefaulted())
+        Rewriter.ReplaceText(
+            clang::SourceRange(Ctor->getTypeSourceInfo()
+                                   ->getTypeLoc()
+                                   .getEndLoc()
+                                   .getLocWithOffset(1),
+                               Ctor->getEndLoc()),
+            " { " + SetTag + " }");
+      else
+        Rewriter.InsertTextAfterToken(getTagSettingBody(Ctor)->getLBracLoc(),
+                                      SetTag);
+    }
+  }
+}
+
+void TraversalSynthesizer::WriteUpdates(
+    const std::vector<clang::CallExpr *> CallsExpressions,
+    clang::FunctionDecl *EnclosingFunctionDecl) {
+
+  // Call sites inside traversals run once per node, they are not worth
+  // multiversioning
+  bool Multiversioned =
+      opts::Multiversion && !hasFuseAnnotation(EnclosingFunctionDecl);
+
+  if (!Multiversioned) {
+    for (auto *CallExpr : CallsExpressions)
+      Rewriter.InsertText(CallExpr->getBeginLoc(), "//");
+  }
+
+  // add forward declarations
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    Rewriter.InsertText(
+        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+        (SynthesizedFunction.second->ForwardDeclaration) + string(";\n"));
+  }
+
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    Rewriter.InsertText(
+        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+        (SynthesizedFunction.second->ForwardDeclaration_serial) +
+            string(";\n"));
+  }
+
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    if (SynthesizedFunction.second->FrontierDeclaration != "")
+      Rewriter.InsertText(
+          EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+          SynthesizedFunction.second->FrontierDeclaration + string(";\n"));
+  }
+
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    if (SynthesizedFunction.second->SpineStepDeclaration != "")
+      Rewriter.InsertText(
+          EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+          SynthesizedFunction.second->SpineStepDeclaration + string(";\n"));
+  }
+
+  static std::set<string> InsertedFunctions;
+
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    if(InsertedFunctions.count(SynthesizedFunction.second->FunctionName))
+    continue;
+    else 
+    InsertedFunctions.insert(SynthesizedFunction.second->FunctionName);
+    Rewriter.InsertText(
+        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+        (SynthesizedFunction.second->ForwardDeclaration + "\n{\n" +
+         instrumentParallelCode(
+             expandUnrolledCalls(SynthesizedFunction.second->Body, 0)) +
+         "\n};\n"));
+  }
+
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    if (InsertedFunctions.count(SynthesizedFunction.second->FunctionName))
+      continue;
+    else
+      InsertedFunctions.insert(SynthesizedFunction.second->FunctionName);
+    Rewriter.InsertText(
+        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+        (SynthesizedFunction.second->ForwardDeclaration_serial + "\n{\n" +
+         instrumentParallelCode(
+             expandUnrolledCalls(SynthesizedFunction.second->Body, 0)) +
+         "\n};\n"));
+  }
+
+  for (auto &SynthesizedFunction : SynthesizedFunctions) {
+    string Key = SynthesizedFunction.second->FunctionName + "_frontier";
+    if (SynthesizedFunction.second->FrontierFunctions == "" ||
+        InsertedFunctions.count(Key))
+      continue;
+    InsertedFunctions.insert(Key);
+    Rewriter.InsertText(
+        EnclosingFunctionDecl->getTypeSourceInfo()->getTypeLoc().getBeginLoc(),
+        SynthesizedFunction.second->FrontierFunctions);
+  }
+
+  // 2-build the new function call and add It.
+  string ParallelCall = createTopLevelCall(CallsExpressions, "_parallel",
+                                           ", startDepth, maximumDepth");
+  if (isFrontierCall(CallsExpressions)) {
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            EnclosingFunctionDecl->getBeginLoc(),
+                            RuntimeSupport::Frontier);
+    ParallelCall = "_orchard_frontier_run([&] {\n\t" +
+                   createTopLevelCall(CallsExpressions, "_frontier", "") +
+                   "\n\t});";
+  }
+  string SerialCall = createTopLevelCall(CallsExpressions, "_serial", "");
+
+  // the work and span of the parallel call are recorded for its call site
+  if (opts::WorkSpan) {
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            EnclosingFunctionDecl->getBeginLoc(),
+                            RuntimeSupport::WorkSpan);
+    ParallelCall = "{\n\t_ORCHARD_WS_ROOT(\"" +
+                   CallsExpressions[0]->getBeginLoc().printToString(
+                       ASTCtx->getSourceManager()) +
+                   "\")\n\t" + ParallelCall + "\n\t}";
+  }
+
+  // a new search starts, clear the cancellation of short-circuitable
+  // traversals
+  string ShortCircuitReset = "";
+  for (auto *CallExpr : CallsExpressions) {
+    int Slot = getShortCircuitSlot(
+        CallExpr->getCalleeDecl()->getAsFunction()->getDefinition());
+    if (Slot != -1)
+      ShortCircuitReset +=
+          "_orchard_short_circuit_reset(" + to_string(Slot) + ");\n\t";
+  }
+  if (ShortCircuitReset != "") {
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            EnclosingFunctionDecl->getBeginLoc(),
+                            RuntimeSupport::ShortCircuit);
+    ParallelCall = ShortCircuitReset + ParallelCall;
+    SerialCall = ShortCircuitReset + SerialCall;
+  }
+
+  auto AfterLastCall = Lexer::findLocationAfterToken(
+      CallsExpressions[CallsExpressions.size() - 1]->getEndLoc(),
+      tok::TokenKind::semi, ASTCtx->getSourceManager(), ASTCtx->getLangOpts(),
+      true);
+
+  if (Multiversioned) {
+    // Keep the original calls in place and select at runtime between them and
+    // the serial and parallel fused traversals
+    static int SitesCount = 0;
+    string SiteName = "_orchard_site_" + to_string(SitesCount++);
+
+    RuntimeSupport::require(ASTCtx->getSourceManager(),
+                            EnclosingFunctionDecl->getBeginLoc(),
+                            RuntimeSupport::Multiversioning);
+
+    Rewriter.InsertTextBefore(
+        CallsExpressions[0]->getBeginLoc(),
+        "//added by fuse transformer \n\t{\n\tstatic _orchard_mv_site " +
+            SiteName + ";\n\tint _orchard_version = _orchard_mv_select(" +
+            SiteName +
+            ");\n\tauto _orchard_start = "
+            "std::chrono::steady_clock::now();\n\tif (_orchard_version == "
+            "_ORCHARD_ORIGINAL) {\n\t");
+
+    string NewCall = "\n\t} else if (_orchard_version == _ORCHARD_SERIAL) {\n\t";
+    NewCall += SerialCall;
+    NewCall += "\n\t} else {\n\tint startDepth = 0;\n\tint maximumDepth = "
+               "1024;\n\t";
+    NewCall += ParallelCall;
+    NewCall += "\n\t}\n\t_orchard_mv_record(" + SiteName +
+               ", _orchard_version, _orchard_start);\n\t}\n";
+
+    Rewriter.InsertTextAfter(AfterLastCall, NewCall);
+  } else {
+    string NewCall = "";
+
+    NewCall += "\n\tint startDepth = 0;\n\t";
+
+    NewCall += "\n\tint maximumDepth = 1024;\n\t";
+
+    NewCall += "\n\tif (startDepth < maximumDepth)";
+    NewCall += " {";
+    NewCall += "\n";
+    NewCall += ParallelCall;
+    NewCall += "\n\t}";
+    NewCall += "\n\telse{\n\t";
+    NewCall += SerialCall;
+    NewCall += "\n\t}";
+
+    Rewriter.InsertTextAfter(AfterLastCall, "\n\t//added by fuse transformer \n\t" +
+                                                NewCall + "\n");
+  }
 
   // add virtual stubs
 
@@ -1686,10 +3662,9 @@ void TraversalSynthesizer::WriteUpdates(
 
     string Params_serial = "";
 
-    string Args_serial = "";
-
     string Params = "";
-    string Args = "this";
+    // the arguments of the stubs, without the node they are called on
+    string ArgList = "";
 
     int Idx = -1;
     for (auto *Decl : TraversalsDeclarationsList) {
@@ -1704,8 +3679,8 @@ void TraversalSynthesizer::WriteUpdates(
         Params += (Params == "" ? "" : ", ") +
                   string(Param->getType().getAsString()) + " _f" +
                   to_string(Idx) + "_" + Param->getDeclName().getAsString();
-        Args += (Args == "" ? "" : ", ") + string(" _f") + to_string(Idx) +
-                "_" + Param->getDeclName().getAsString();
+        ArgList += (ArgList == "" ? "" : ", ") + string("_f") +
+                   to_string(Idx) + "_" + Param->getDeclName().getAsString();
       }
     }
 
@@ -1719,17 +3694,19 @@ void TraversalSynthesizer::WriteUpdates(
     Params += string(", int depth, int maxDepth");
     /**********************************************/
 
-    Args += ", truncate_flags";
+    ArgList += (ArgList == "" ? "" : ", ") + string("truncate_flags");
 
     // copy args to serial args as this is all that is needed for the serial
     // code
-    Args_serial = Args;
+    string ArgList_serial = ArgList;
 
     // passing the depth and maxDepth variables to the fused functions
-    Args += ", depth";
-    Args += ", maxDepth";
+    ArgList += ", depth, maxDepth";
     /*******************************************************************/
 
+    string Args = "this, " + ArgList;
+    string Args_serial = "this, " + ArgList_serial;
+
     auto LambdaFun = [&](const CXXRecordDecl *DerivedType) {
       if (InsertedStubs[DerivedType].count(Entry.second))
         return;
@@ -1776,12 +3753,102 @@ void TraversalSynthesizer::WriteUpdates(
 
               + "}\n\n\n");
 
+      // the stub that pushes the node to the frontier
+      if (opts::FrontierMode) {
+        Rewriter.InsertText(DerivedType->getDefinition()->getEndLoc(),
+                            (DerivedType == CalledChildType ? "virtual" : "") +
+                                string(" void ") + StubName + "_frontier(" +
+                                Params_serial + ")" +
+                                (DerivedType == CalledChildType ? ""
+                                                                : "override") +
+                                ";\n");
+        Rewriter.InsertTextAfter(
+            EnclosingFunctionDecl->getAsFunction()
+                ->getDefinition()
+                ->getTypeSourceInfo()
+                ->getTypeLoc()
+                .getBeginLoc(),
+            "void " + DerivedType->getNameAsString() + "::" + StubName +
+                "_frontier(" + Params_serial + "){" +
+                createName(Calls, true, DerivedType) + "_frontier(" +
+                Args_serial + ");}\n\n\n");
+      }
+
       return;
     };
     LambdaFun(CalledChildType);
     for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[CalledChildType]) {
       LambdaFun(DerivedType);
     }
+
+    if (!opts::ClosedHierarchy || !hasTypeTags(CalledChildType))
+      continue;
+
+    // Static dispatchers of the called child type that switch over the type
+    // tag and call the fused traversal of the dynamic type directly, the
+    // virtual stub is kept for classes without a tag
+    static std::set<std::string> InsertedDispatchers;
+    if (InsertedDispatchers.count(StubName))
+      continue;
+    InsertedDispatchers.insert(StubName);
+
+    insertTypeTags(CalledChildType);
+
+    string ChildTypeName = CalledChildType->getNameAsString();
+    string DispatcherParams = ChildTypeName + " *_r" +
+                              (Params == "" ? "" : ", " + Params);
+    string DispatcherParams_serial =
+        ChildTypeName + " *_r" +
+        (Params_serial == "" ? "" : ", " + Params_serial);
+    string DispatcherArgs = ", " + ArgList;
+    string DispatcherArgs_serial = ", " + ArgList_serial;
+
+    Rewriter.InsertText(CalledChildType->getDefinition()->getEndLoc(),
+                        "public: static void " + StubName +
+                            "_dispatch_parallel(" + DispatcherParams + ");\n" +
+                            "static void " + StubName + "_dispatch_serial(" +
+                            DispatcherParams_serial + ");\n" +
+                            (opts::FrontierMode
+                                 ? "static void " + StubName +
+                                       "_dispatch_frontier(" +
+                                       DispatcherParams_serial + ");\n"
+                                 : ""));
+
+    string Cases = "", Cases_serial = "", Cases_frontier = "";
+    auto AddCase = [&](const CXXRecordDecl *DerivedType) {
+      string Case = "case " + to_string(getTypeTag(DerivedType)) + ": " +
+                    createName(Calls, true, DerivedType);
+      string Cast = "((" + DerivedType->getNameAsString() + " *)_r)";
+      Cases += Case + "_parallel(" + Cast + DispatcherArgs + "); return;\n";
+      Cases_serial +=
+          Case + "_serial(" + Cast + DispatcherArgs_serial + "); return;\n";
+      Cases_frontier +=
+          Case + "_frontier(" + Cast + DispatcherArgs_serial + "); return;\n";
+    };
+    AddCase(CalledChildType);
+    for (auto *DerivedType : RecordsAnalyzer::DerivedRecords[CalledChildType])
+      AddCase(DerivedType);
+
+    Rewriter.InsertTextAfter(
+        EnclosingFunctionDecl->getAsFunction()
+            ->getDefinition()
+            ->getTypeSourceInfo()
+            ->getTypeLoc()
+            .getBeginLoc(),
+        "void " + ChildTypeName + "::" + StubName + "_dispatch_parallel(" +
+            DispatcherParams + "){\nswitch (_r->_orchard_tag) {\n" + Cases +
+            "}\n_r->" + StubName + "_parallel(" + ArgList + ");\n}\n\n" +
+            "void " + ChildTypeName + "::" + StubName + "_dispatch_serial(" +
+            DispatcherParams_serial + "){\nswitch (_r->_orchard_tag) {\n" +
+            Cases_serial + "}\n_r->" + StubName + "_serial(" +
+            ArgList_serial + ");\n}\n\n" +
+            (opts::FrontierMode
+                 ? "void " + ChildTypeName + "::" + StubName +
+                       "_dispatch_frontier(" + DispatcherParams_serial +
+                       "){\nswitch (_r->_orchard_tag) {\n" + Cases_frontier +
+                       "}\n_r->" + StubName + "_frontier(" +
+                       ArgList_serial + ");\n}\n\n"
+                 : ""));
   }
 }
 
@@ -1820,7 +3887,9 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
 
     if (BinaryOperator->isAssignmentOp())
       Output += "\t";
+    size_t LHSBegin = Output.size();
     print_handleStmt(BinaryOperator->getLHS(), SM);
+    string LHSText = Output.substr(LHSBegin);
 
     // print op
     Output += BinaryOperator->getOpcodeStr();
@@ -1830,6 +3899,21 @@ void StatementPrinter::print_handleStmt(const clang::Stmt *Stmt,
     if (BinaryOperator->isAssignmentOp())
       Output += ";\n";
 
+    // a result of a short-circuitable traversal cancels the other workers
+    if (BinaryOperator->isAssignmentOp() && ShortCircuits.count(TraversalIndex)) {
+      auto *Member = dyn_cast<clang::MemberExpr>(
+          BinaryOperator->getLHS()->IgnoreImplicit());
+      if (Member &&
+          Member->getMemberDecl() == ShortCircuits[TraversalIndex].first) {
+        auto *Base = Member->getBase()->IgnoreImpCasts();
+        auto *BaseDeclRef = dyn_cast<clang::DeclRefExpr>(Base);
+        if (isa<clang::CXXThisExpr>(Base) ||
+            (BaseDeclRef && BaseDeclRef->getDecl() == RootNodeDecl))
+          Output += "\t if (" + LHSText + ") _orchard_short_circuit(" +
+                    to_string(ShortCircuits[TraversalIndex].second) + ");\n";
+      }
+    }
+
     NestedExpressionDepth--;
     break;
   }
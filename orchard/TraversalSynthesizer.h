@@ -28,6 +28,35 @@ class StatementPrinter;
 class FusionTransformer;
 
 class TraversalSynthesizer {
+public:
+  /// A call of a helper annotated with tf_strict_access whose body is a
+  /// single loop over a range of the member arrays, see -fuse-helper-loops
+  struct HelperLoop {
+    const clang::CXXMemberCallExpr *Call = nullptr;
+    const clang::FunctionDecl *Definition = nullptr;
+    /// The loop variable and the body of the loop
+    const clang::VarDecl *Index = nullptr;
+    const clang::Stmt *Body = nullptr;
+    /// The text of the initial value and of the bound of the loop variable
+    std::string Init, Bound;
+    /// The fields of the access path of the object of the call
+    std::vector<const clang::ValueDecl *> Path;
+    int TraversalIndex;
+    clang::ValueDecl *RootDecl;
+  };
+
+  /// An update x op= e, or x = x op e, of a floating point field x of the
+  /// visited node with op one of + - * /, see -combine-updates
+  struct AffineUpdate {
+    const clang::Expr *Target = nullptr;
+    const clang::Expr *Operand = nullptr;
+    clang::BinaryOperatorKind Opcode;
+    /// The fields of the access path of the target
+    std::vector<const clang::ValueDecl *> Path;
+    int TraversalIndex;
+    clang::ValueDecl *RootDecl;
+  };
+
 private:
   static std::map<clang::FunctionDecl *, int> FunDeclToNameId;
   static int Count;
@@ -63,6 +92,18 @@ private:
       int BlockId, std::unordered_map<int, vector<DG_Node *>> &Statements,
       bool HasCXXCall);
 
+  /// Return a call of a helper, inserted in the class of the helpers, that
+  /// runs the loops of consecutive helper calls on the same object as one
+  /// loop
+  std::string getFusedHelperCall(const std::vector<HelperLoop> &Loops,
+                                 StatementPrinter &Printer, bool HasCXXCall);
+
+  /// Return a single update of the field that consecutive affine updates of
+  /// the same field update, with their composed scale and offset computed
+  /// first
+  std::string getCombinedUpdate(const std::vector<AffineUpdate> &Updates,
+                                StatementPrinter &Printer, bool HasCXXCall);
+
   ///
   void setCallPart(
       std::string &CallPartText,
@@ -71,11 +112,103 @@ private:
       DG_Node *CallNode, FusedTraversalWritebackInfo *WriteBackInfo,
       bool HasCXXCall, int isParallel);
 
+  /// Return the early return guard of the function(s) that CallNode calls with
+  /// the call arguments substituted, or an empty string if the guard cannot
+  /// be evaluated at the call site
+  std::string getHoistedGuard(DG_Node *CallNode, bool HasCXXCall);
+
+  /// Return the prefetches of the children visited by the calls of the
+  /// synthesized traversal, and of their descendants up to
+  /// -prefetch-distance levels
+  std::string
+  getChildPrefetches(const std::vector<vector<DG_Node *>> &TopologicalOrder,
+                     bool HasCXXCall);
+
+  /// Return the cancellation slot of a traversal annotated with
+  /// tf_short_circuit(<result field>) and set ResultField, or -1
+  int getShortCircuitSlot(clang::FunctionDecl *Traversal,
+                          const clang::FieldDecl **ResultField = nullptr);
+
+  /// Return the code that drops the cancelled short-circuitable traversals
+  /// at the entry of a synthesized function
+  std::string getShortCircuitEntryCheck(
+      const std::vector<clang::FunctionDecl *> &ParticipatingTraversalsDecl);
+
+  /// Generate the code of a heavy statement that runs within a level of
+  /// calls, as a spawned task if Spawn is set
+  void setHeavyStmtPart(
+      std::string &HeavyStmtText,
+      const std::vector<clang::FunctionDecl *> &ParticipatingTraversalsDecl,
+      DG_Node *StmtNode, bool HasCXXCall, bool Spawn);
+
   /// Return true if a subtraversal with the given participating traversal
   /// is already synthesized
   bool
   isGenerated(const vector<clang::FunctionDecl *> &ParticipatingTraversals);
 
+  /// A serial call to a synthesized traversal that may be replaced by the
+  /// body of the callee
+  struct UnrollSite {
+    std::string CalleeName;
+    /// The child followed by the arguments and the truncate flags
+    std::vector<std::string> Arguments;
+    std::string CallText;
+  };
+  std::vector<UnrollSite> UnrollSites;
+
+  /// Replace the unrolling placeholders of Text with the inlined serial body
+  /// of the callee, up to -unroll-depth levels, or with the original call
+  std::string expandUnrolledCalls(const std::string &Text, unsigned Depth);
+
+  /// Return the serial body of a self recursive synthesized traversal as a
+  /// loop over an explicit stack of frames, Segments are the blocks and calls
+  /// of the recursive body in order. Return an empty string if a call is not
+  /// a call to the traversal itself
+  std::string createIterativeSerialBody(
+      FusedTraversalWritebackInfo *WriteBackInfo,
+      const std::vector<std::pair<bool, std::string>> &Segments,
+      const std::vector<clang::FunctionDecl *> &TraversalsDeclarationsList,
+      bool HasCXXCall, const std::string &Prologue);
+
+  /// Return the functions that visit the node of the synthesized traversal
+  /// in a level of the frontier and push its children to the next level, or
+  /// a serial visit of the whole subtree if not Eligible. Segments are the
+  /// blocks and calls of the serial body in order
+  std::string createFrontierFunctions(
+      FusedTraversalWritebackInfo *WriteBackInfo,
+      const std::vector<std::pair<bool, std::string>> &Segments,
+      const std::string &Prologue, const std::string &RootCasting,
+      bool Eligible);
+
+  /// Return true if the top level calls are run level by level, see
+  /// -frontier
+  bool isFrontierCall(const std::vector<clang::CallExpr *> &CallsExpressions);
+
+  /// Return the code that visits the chain of nodes of DerivedType linked by
+  /// the child of CallNode with a parallel loop and then calls the end of the
+  /// chain with CallPartText, or an empty string if the recursive call is not
+  /// independent from the rest of the body
+  std::string
+  createSpineCall(const std::string &CallPartText,
+                  const std::vector<clang::CallExpr *> &ParticipatingCalls,
+                  const std::vector<vector<DG_Node *>> &TopologicalOrder,
+                  DG_Node *CallNode, FusedTraversalWritebackInfo *WriteBackInfo,
+                  bool HasCXXCall, const CXXRecordDecl *DerivedType);
+
+  /// Return the name of the static member of the called child type that
+  /// dispatches the given virtual calls over the type tag
+  std::string getTagDispatcher(const std::vector<clang::CallExpr *> &Calls);
+
+  /// Add the type tag members to the tree classes of the hierarchy of Record
+  void insertTypeTags(const CXXRecordDecl *Record);
+
+  /// Return the text of a call to the fused traversal of the given top level
+  /// calls, Suffix selects the variant (_parallel or _serial)
+  std::string
+  createTopLevelCall(const std::vector<clang::CallExpr *> &CallsExpressions,
+                     const std::string &Suffix,
+                     const std::string &ExtraArguments);
+
 public:
   static std::map<std::vector<clang::CallExpr *>, string> Stubs;
 
@@ -160,7 +293,19 @@ private:
   static std::unordered_map<const CXXRecordDecl *, std::set<std::string>>
       InsertedStubs;
 
+  /// The result field and cancellation slot of the short-circuitable
+  /// traversals, by traversal index
+  std::unordered_map<int, std::pair<const clang::FieldDecl *, int>>
+      ShortCircuits;
+
 public:
+  /// Publish a result of the traversal each time a true value is assigned to
+  /// ResultField of the root
+  void setShortCircuit(int TraversalIndex_, const clang::FieldDecl *ResultField,
+                       int Slot) {
+    ShortCircuits[TraversalIndex_] = std::make_pair(ResultField, Slot);
+  }
+
   /// Return a new string for the given statement that is used in the new
   /// synthesized traversal
   std::string printStmt(const clang::Stmt *Stmt, SourceManager &SM,
@@ -200,6 +345,18 @@ public:
   std::string ForwardDeclaration_serial;
   std::string FunctionName;
   std::vector<clang::CallExpr *> ParticipatingCalls;
+  /// The body of the serial variant, and its parameters as declared
+  std::string SerialBody;
+  std::vector<std::string> SerialParameters;
+  /// The declaration of the visit of one node of a chain, see -chunk-spines
+  std::string SpineStepDeclaration;
+  /// The declaration of the frontier variant and its definitions, see
+  /// -frontier
+  std::string FrontierDeclaration;
+  std::string FrontierFunctions;
+  /// Whether the frontier variant pushes the children to the next level
+  /// rather than visiting the subtree serially
+  bool FrontierEligible = false;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,344 @@
+//===--- TreeLayout.cpp ---------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//===----------------------------------------------------------------------===//
+
+#include "TreeLayout.h"
+#include "Logger.h"
+#include "RuntimeSupport.h"
+#include <set>
+
+using namespace std;
+
+extern llvm::cl::OptionCategory TreeFuserCategory;
+namespace opts {
+llvm::cl::opt<bool> Relayout(
+    "relayout",
+    cl::desc("generate _orchard_relayout(Root) for each tree class, it moves "
+             "the nodes of a tree into one contiguous arena in depth first "
+             "order and frees the old nodes"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+
+llvm::cl::opt<bool> PoolAllocators(
+    "pool-allocators",
+    cl::desc("give the roots of the tree hierarchies an operator new and an "
+             "operator delete that allocate the nodes from per worker, size "
+             "segregated pools"),
+    cl::init(false), cl::Optional, cl::cat(TreeFuserCategory));
+} // namespace opts
+
+bool TreeLayoutSynthesizer::VisitCXXRecordDecl(clang::CXXRecordDecl *Record) {
+  if (Record->isThisDeclarationADefinition() && hasTreeAnnotation(Record))
+    TreeRecords.push_back(Record);
+  return true;
+}
+
+const clang::CXXRecordDecl *
+TreeLayoutSynthesizer::getRoot(const clang::CXXRecordDecl *Record) {
+  for (auto &Base : Record->bases()) {
+    auto *BaseRecord = Base.getType()->getAsCXXRecordDecl();
+    if (BaseRecord && hasTreeAnnotation(BaseRecord))
+      return getRoot(BaseRecord);
+  }
+  return Record;
+}
+
+void TreeLayoutSynthesizer::collectChildFields(
+    const clang::CXXRecordDecl *Record,
+    std::vector<clang::FieldDecl *> &Fields) {
+  for (auto &Base : Record->bases())
+    if (auto *BaseRecord = Base.getType()->getAsCXXRecordDecl())
+      collectChildFields(BaseRecord, Fields);
+  for (auto *Field : Record->fields())
+    if (hasChildAnnotation(Field))
+      Fields.push_back(Field);
+}
+
+void TreeLayoutSynthesizer::insertPoolOperators() {
+  auto &SM = Ctx->getSourceManager();
+  // headers are shared by several translation units
+  static std::set<std::string> Inserted;
+
+  for (auto *Record : TreeRecords) {
+    auto *Root = getRoot(Record);
+    if (Root != Record)
+      continue;
+
+    bool Supported = !Root->getNumVBases();
+    for (auto *Decl : Root->decls())
+      if (auto *Function = Decl->getAsFunction())
+        if (Function->getOverloadedOperator() == OO_New ||
+            Function->getOverloadedOperator() == OO_Delete)
+          Supported = false;
+    // the pools only guarantee the alignment of the granule
+    bool HasSubclasses = false;
+    for (auto *Other : TreeRecords)
+      if (getRoot(Other) == Root) {
+        HasSubclasses |= Other != Root;
+        if (Ctx->getTypeAlignInChars(Ctx->getRecordType(Other))
+                .getQuantity() > 16)
+          Supported = false;
+      }
+    if (!Supported) {
+      Logger::getStaticLogger().logWarn(
+          "pool allocators: " + Root->getNameAsString() +
+          " defines its own allocation or is over-aligned, skipping");
+      continue;
+    }
+    // deleting a derived node through the root passes the size of the root
+    // to the sized operator delete unless the destructor is virtual
+    auto *Destructor = Root->getDestructor();
+    if (HasSubclasses && !(Destructor && Destructor->isVirtual())) {
+      Logger::getStaticLogger().logWarn(
+          "pool allocators: " + Root->getNameAsString() +
+          " has subclasses and no virtual destructor, skipping");
+      continue;
+    }
+
+    auto Loc = Root->getEndLoc();
+    if (!clang::Rewriter::isRewritable(Loc))
+      continue;
+    PooledRoots.insert(Root);
+    if (!Inserted.insert(Loc.printToString(SM)).second)
+      continue;
+
+    RuntimeSupport::require(SM, Loc, RuntimeSupport::PoolAllocator);
+    Rewriter.InsertText(
+        Loc, "public:\n"
+             "static void *operator new(std::size_t Size) {\n"
+             "return _orchard_pool_allocate(Size);\n}\n"
+             "static void operator delete(void *Node, std::size_t Size) {\n"
+             "_orchard_pool_free(Node, Size);\n}\n");
+  }
+}
+
+std::string TreeLayoutSynthesizer::createRelayoutFunctions() {
+  std::vector<const clang::CXXRecordDecl *> Roots;
+  for (auto *Record : TreeRecords) {
+    if (Record->getNumVBases()) {
+      Logger::getStaticLogger().logWarn(
+          "relayout: virtual bases are not supported, skipping");
+      return "";
+    }
+    auto *Root = getRoot(Record);
+    if (!Kinds.count(Root)) {
+      Kinds[Root] = Roots.size();
+      Roots.push_back(Root);
+    }
+  }
+
+  // The concrete classes of each kind and their children
+  std::vector<std::vector<const clang::CXXRecordDecl *>> Classes(Roots.size());
+  std::map<const clang::CXXRecordDecl *, std::vector<clang::FieldDecl *>>
+      Children;
+  for (auto *Record : TreeRecords) {
+    if (Record->isAbstract())
+      continue;
+    Classes[Kinds[getRoot(Record)]].push_back(Record);
+    collectChildFields(Record, Children[Record]);
+    for (auto *Field : Children[Record]) {
+      auto *Pointee = Field->getType()->getPointeeCXXRecordDecl();
+      if (!Pointee || !Kinds.count(getRoot(Pointee->getDefinition()))) {
+        Logger::getStaticLogger().logWarn(
+            "relayout: child " + Field->getNameAsString() +
+            " is not a tree class, skipping");
+        return "";
+      }
+    }
+  }
+  for (int Kind = 0; Kind < Roots.size(); Kind++)
+    if (Classes[Kind].size() > 1 && !Roots[Kind]->isPolymorphic()) {
+      Logger::getStaticLogger().logWarn(
+          "relayout: " + Roots[Kind]->getNameAsString() +
+          " has subclasses but no virtual function, skipping");
+      return "";
+    }
+
+  auto KindOf = [&](clang::FieldDecl *Field) {
+    return Kinds[getRoot(
+        Field->getType()->getPointeeCXXRecordDecl()->getDefinition())];
+  };
+  auto RootName = [&](int Kind) { return Roots[Kind]->getNameAsString(); };
+
+  // The passes dispatch over the kind and the dynamic type of the node
+  string SizePass = "", CopyPass = "", FreePass = "", Links = "";
+  int FieldId = 0;
+  for (int Kind = 0; Kind < Roots.size(); Kind++) {
+    string Case = "case " + to_string(Kind) + ": {\n" + RootName(Kind) +
+                  " *_orchard_node = (" + RootName(Kind) + " *)Entry.Node;\n";
+    SizePass += Case;
+    CopyPass += Case;
+    FreePass += Case;
+    for (auto *Class : Classes[Kind]) {
+      string Name = Class->getNameAsString();
+      string Test = Classes[Kind].size() > 1
+                        ? "if (typeid(*_orchard_node) == typeid(" + Name +
+                              ")) {\n"
+                        : "{\n";
+
+      SizePass += Test + "Size += _ORCHARD_RELAYOUT_SIZE(" + Name + ");\n";
+      for (auto *Field : Children[Class])
+        SizePass += "Stack.push_back(_orchard_relayout_entry{" +
+                    to_string(KindOf(Field)) + ", (void *)(" +
+                    RootName(KindOf(Field)) + " *)static_cast<" + Name +
+                    " *>(_orchard_node)->" + Field->getNameAsString() +
+                    ", nullptr, -1});\n";
+      SizePass += "break;\n}\n";
+
+      // The children are cleared before the destructor runs, so that a
+      // destructor that deletes them does not reach the relaid nodes
+      string Destroy = "";
+      for (auto *Field : Children[Class])
+        Destroy += "static_cast<" + Name + " *>(_orchard_node)->" +
+                   Field->getNameAsString() + " = nullptr;\n";
+      Destroy +=
+          "static_cast<" + Name + " *>(_orchard_node)->~" + Name + "();\n";
+
+      // the root is the first node of the arena
+      FreePass += Test +
+                  "if (Entry.Field == -1)\nArena = (void *)static_cast<" +
+                  Name + " *>(_orchard_node);\n";
+      for (auto *Field : Children[Class])
+        FreePass += "Stack.push_back(_orchard_relayout_entry{" +
+                    to_string(KindOf(Field)) + ", (void *)(" +
+                    RootName(KindOf(Field)) + " *)static_cast<" + Name +
+                    " *>(_orchard_node)->" + Field->getNameAsString() +
+                    ", nullptr, 0});\n";
+      FreePass += Destroy + "break;\n}\n";
+
+      CopyPass += Test + Name + " *New = ::new (Arena + Used) " + Name +
+                  "(std::move(*static_cast<" + Name +
+                  " *>(_orchard_node)));\n";
+      CopyPass += "Used += _ORCHARD_RELAYOUT_SIZE(" + Name + ");\n";
+      CopyPass += Destroy;
+      // a size of zero for the nodes of the global allocator
+      CopyPass += "Old.push_back({(void *)static_cast<" + Name +
+                  " *>(_orchard_node), " +
+                  (PooledRoots.count(Roots[Kind]) ? "sizeof(" + Name + ")"
+                                                  : string("0")) +
+                  "});\n";
+      CopyPass += "Copy = (void *)(" + RootName(Kind) + " *)New;\n";
+      // the first child is pushed last to be copied right after its parent
+      for (auto It = Children[Class].rbegin(); It != Children[Class].rend();
+           It++) {
+        auto *Field = *It;
+        CopyPass += "Stack.push_back(_orchard_relayout_entry{" +
+                    to_string(KindOf(Field)) + ", (void *)(" +
+                    RootName(KindOf(Field)) + " *)New->" +
+                    Field->getNameAsString() + ", (void *)New, " +
+                    to_string(FieldId) + "});\n";
+        Links += "case " + to_string(FieldId) + ": ((" + Name +
+                 " *)Entry.Parent)->" + Field->getNameAsString() +
+                 " = static_cast<" +
+                 Field->getType()->getPointeeType().getAsString() + " *>((" +
+                 RootName(KindOf(Field)) + " *)Copy);\nbreak;\n";
+        FieldId++;
+      }
+      CopyPass += "break;\n}\n";
+    }
+    SizePass += "std::abort();\n}\n";
+    CopyPass += "std::abort();\n}\n";
+    FreePass += "std::abort();\n}\n";
+  }
+
+  string Text = "\n//added by fuse transformer: relayout of the trees\n";
+  Text += "struct _orchard_relayout_entry {\nint Kind;\nvoid *Node;\n"
+          "void *Parent;\nint Field;\n};\n\n";
+  Text += "static inline void *_orchard_relayout_tree(int Kind, void *Root) "
+          "{\n";
+  Text += "std::vector<_orchard_relayout_entry> Stack;\nsize_t Size = 0;\n";
+  Text += "Stack.push_back(_orchard_relayout_entry{Kind, Root, nullptr, "
+          "-1});\n";
+  Text += "while (!Stack.empty()) {\n_orchard_relayout_entry Entry = "
+          "Stack.back();\nStack.pop_back();\nif (!Entry.Node)\ncontinue;\n";
+  Text += "switch (Entry.Kind) {\n" + SizePass + "}\n}\n\n";
+
+  Text += "if (!Size)\nreturn nullptr;\n";
+  Text += "unsigned char *Arena = (unsigned char *)std::malloc(Size);\n"
+          "size_t Used = 0;\nvoid *NewRoot = nullptr;\n";
+  Text += "std::vector<std::pair<void *, std::size_t>> Old;\n";
+  Text += "Stack.push_back(_orchard_relayout_entry{Kind, Root, nullptr, "
+          "-1});\n";
+  Text += "while (!Stack.empty()) {\n_orchard_relayout_entry Entry = "
+          "Stack.back();\nStack.pop_back();\nvoid *Copy = nullptr;\n";
+  Text += "if (Entry.Node) {\nswitch (Entry.Kind) {\n" + CopyPass + "}\n}\n";
+  Text += "switch (Entry.Field) {\ncase -1:\nNewRoot = Copy;\nbreak;\n" +
+          Links + "}\n}\n\n";
+  Text += "// the moved-from nodes are already destroyed\n";
+  Text += "for (auto &Node : Old)\n";
+  if (PooledRoots.empty())
+    Text += "::operator delete(Node.first);\n";
+  else
+    Text += "if (Node.second)\n_orchard_pool_free(Node.first, Node.second);\n"
+            "else\n::operator delete(Node.first);\n";
+  Text += "return NewRoot;\n}\n\n";
+
+  Text += "static inline void _orchard_relayout_free_tree(int Kind, "
+          "void *Root) {\n";
+  Text += "std::vector<_orchard_relayout_entry> Stack;\nvoid *Arena = "
+          "nullptr;\n";
+  Text += "Stack.push_back(_orchard_relayout_entry{Kind, Root, nullptr, "
+          "-1});\n";
+  Text += "while (!Stack.empty()) {\n_orchard_relayout_entry Entry = "
+          "Stack.back();\nStack.pop_back();\nif (!Entry.Node)\ncontinue;\n";
+  Text += "switch (Entry.Kind) {\n" + FreePass + "}\n}\n";
+  Text += "std::free(Arena);\n}\n\n";
+
+  for (auto *Record : TreeRecords) {
+    string Name = Record->getNameAsString();
+    int Kind = Kinds[getRoot(Record)];
+    Text += "static inline " + Name + " *_orchard_relayout(" + Name +
+            " *Root) {\nreturn static_cast<" + Name + " *>((" +
+            RootName(Kind) + " *)_orchard_relayout_tree(" + to_string(Kind) +
+            ", (void *)(" + RootName(Kind) + " *)Root));\n}\n\n";
+    Text += "static inline void _orchard_relayout_free(" + Name +
+            " *Root) {\n_orchard_relayout_free_tree(" + to_string(Kind) +
+            ", (void *)(" + RootName(Kind) + " *)Root);\n}\n\n";
+  }
+  return Text;
+}
+
+void TreeLayoutSynthesizer::synthesize() {
+  if (!opts::Relayout && !opts::PoolAllocators)
+    return;
+  TraverseDecl(Ctx->getTranslationUnitDecl());
+  if (TreeRecords.empty())
+    return;
+
+  if (opts::PoolAllocators)
+    insertPoolOperators();
+  if (!opts::Relayout)
+    return;
+
+  auto &SM = Ctx->getSourceManager();
+  const clang::CXXRecordDecl *Last = TreeRecords[0];
+  for (auto *Record : TreeRecords)
+    if (SM.isBeforeInTranslationUnit(Last->getEndLoc(), Record->getEndLoc()))
+      Last = Record;
+
+  auto AfterLast = Lexer::findLocationAfterToken(
+      Last->getEndLoc(), tok::TokenKind::semi, SM, Ctx->getLangOpts(), false);
+  if (AfterLast.isInvalid() || !clang::Rewriter::isRewritable(AfterLast)) {
+    Logger::getStaticLogger().logWarn(
+        "relayout: cannot write after " + Last->getNameAsString());
+    return;
+  }
+
+  // headers are shared by several translation units
+  static std::set<std::string> Inserted;
+  string Key = AfterLast.printToString(SM);
+  if (Inserted.count(Key))
+    return;
+
+  string Text = createRelayoutFunctions();
+  if (Text == "")
+    return;
+  Inserted.insert(Key);
+  RuntimeSupport::require(SM, AfterLast, RuntimeSupport::Relayout);
+  Rewriter.InsertTextAfter(AfterLast, Text);
+}
@@ -0,0 +1,66 @@
+//===--- TreeLayout.h -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+// Synthesizes the functions that move the nodes of the trees into contiguous
+// arenas, in the order in which the traversals visit them, and the pool
+// allocators of the tree classes.
+//===----------------------------------------------------------------------===//
+
+#ifndef TREE_FUSER_TREE_LAYOUT
+#define TREE_FUSER_TREE_LAYOUT
+
+#include "LLVMDependencies.h"
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class TreeLayoutSynthesizer
+    : public clang::RecursiveASTVisitor<TreeLayoutSynthesizer> {
+private:
+  clang::ASTContext *Ctx;
+
+  clang::Rewriter &Rewriter;
+
+  /// Definitions of the tree classes in declaration order
+  std::vector<const clang::CXXRecordDecl *> TreeRecords;
+
+  /// Index of each hierarchy root, the kinds of the generated code
+  std::map<const clang::CXXRecordDecl *, int> Kinds;
+
+  /// Hierarchy roots that allocate their nodes from the pools
+  std::set<const clang::CXXRecordDecl *> PooledRoots;
+
+  /// Return the top most tree class that Record derives from
+  const clang::CXXRecordDecl *getRoot(const clang::CXXRecordDecl *Record);
+
+  /// Collect the child fields of Record and of its bases
+  void collectChildFields(const clang::CXXRecordDecl *Record,
+                          std::vector<clang::FieldDecl *> &Fields);
+
+  /// Add operator new and operator delete backed by the pools to the roots of
+  /// the tree hierarchies, see -pool-allocators
+  void insertPoolOperators();
+
+  /// Return the text of the relayout functions, or an empty string if the
+  /// trees cannot be relaid out
+  std::string createRelayoutFunctions();
+
+public:
+  TreeLayoutSynthesizer(clang::ASTContext *Ctx_, clang::Rewriter &Rewriter_)
+      : Ctx(Ctx_), Rewriter(Rewriter_) {}
+
+  bool VisitCXXRecordDecl(clang::CXXRecordDecl *Record);
+
+  /// Insert the pool operators if -pool-allocators is set and the relayout
+  /// functions after the last tree class of the translation unit if
+  /// -relayout is set
+  void synthesize();
+};
+
+#endif